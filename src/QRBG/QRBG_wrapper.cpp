@@ -17,41 +17,160 @@
    You should have received a copy of the GNU General Public License
    along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
 
-#define CUSTOM_CACHE_SIZE 1024*1024    /* We set QRBG's cache size to 1 MiB */
+#define POOL_INTS (256 * 1024)    /* every pool holds 1 MiB */
 
 #include <iostream>
 #include <cstdlib>
 #include <string>
 #include <cstring>
 #include <strings.h>
-#include "QRBG.h"
+#include <unistd.h>
+#include <pthread.h>
+#include "QRBG.h"
 
-static QRBG rnd_service(CUSTOM_CACHE_SIZE);
+/* We ask for whole pools at a time, which QRBG hands straight over from the
+   socket as long as its own cache is smaller than that */
+static QRBG rnd_service(MINIMAL_CACHE_SIZE);
 
-static int get_int() {
-	try {
-		return rnd_service.getInt();
-	} catch (QRBG::ServiceDenied e) {
-		std::cerr << "QRBG: " << e.why() << "." << endl;
-		std::exit(1);
+/* The shards read from the active pool while a background thread fills the
+   spare one, so nobody waits on the network during a turn. Once the server
+   is running only the refill thread uses rnd_service. pool_lock protects
+   everything but the contents of a spare pool that is being filled. The
+   spare goes back for a refill the moment it is swapped out, which gives
+   the service a whole pool's worth of time to answer. */
+static int pools[2][POOL_INTS];
+static int *active = pools[0], *spare = pools[1];
+static size_t active_pos = POOL_INTS;
+static int spare_ready = 0, refilling = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refill_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+
+/* Fetches a whole pool from the service. Connection trouble is fatal during
+   startup, later on we keep trying since the active pool may last a while. */
+static void fill_pool(int *pool, bool retry) {
+	size_t got = 0;
+	
+	while (got < POOL_INTS) {
+		try {
+			got += rnd_service.getInts(pool + got, POOL_INTS - got);
+		} catch (QRBG::ServiceDenied &e) {
+			std::cerr << "QRBG: " << e.why() << "." << endl;
+			std::exit(1);
+		} catch (exception &e) {
+			if (!retry) {
+				std::cerr << "QRBG: Unable to reach the service." << endl;
+				std::exit(1);
+			}
+			sleep(1);
+		}
+	}
+}
+
+static void *refill_main(void *arg) {
+	int *pool;
+	
+	(void) arg;
+	
+	for (;;) {
+		pthread_mutex_lock(&pool_lock);
+		while (!refilling) {
+			pthread_cond_wait(&refill_cond, &pool_lock);
+		}
+		pool = spare;
+		pthread_mutex_unlock(&pool_lock);
+		
+		fill_pool(pool, true);
+		
+		pthread_mutex_lock(&pool_lock);
+		spare_ready = 1;
+		refilling = 0;
+		pthread_cond_broadcast(&ready_cond);
+		pthread_mutex_unlock(&pool_lock);
 	}
+	
+	return NULL;
 }
-
-extern "C" int QRBG_init() {
+
+/* Copies n ints out of the pools. Only blocks if the refill thread fell a
+   whole pool behind. */
+static void take_ints(int *buf, size_t n) {
+	int *tmp;
+	size_t k;
+	
+	pthread_mutex_lock(&pool_lock);
+	while (n) {
+		if (active_pos == POOL_INTS) {
+			while (!spare_ready) {
+				pthread_cond_wait(&ready_cond, &pool_lock);
+			}
+			tmp = active;
+			active = spare;
+			spare = tmp;
+			active_pos = 0;
+			spare_ready = 0;
+			refilling = 1;
+			pthread_cond_signal(&refill_cond);
+		}
+		
+		k = POOL_INTS - active_pos < n ? POOL_INTS - active_pos : n;
+		memcpy(buf, active + active_pos, k * sizeof(int));
+		active_pos += k;
+		buf += k;
+		n -= k;
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* Fills the first pool right away, so that problems with the account show
+   up before we go to the background. */
+extern "C" int QRBG_connect(const char *host, unsigned int port,
+                            const char *user, const char *pass) {
+	rnd_service.defineServer(host, port);
+	rnd_service.defineUser(user, pass);
+	
+	fill_pool(active, false);
+	active_pos = 0;
+	
+	return active[0];
+}
+
+/* Asks for the credentials, then connects */
+extern "C" int QRBG_init(const char *host, unsigned int port) {
 	char *pass;
 	string user;
+	int r;
 	
 	std::cout << "QRBG username: ";
 	std::cin >> user;
 	pass = getpass("QRBG password: ");
 	
-	rnd_service.defineServer("random.irb.hr", 1227);
-	rnd_service.defineUser(user.c_str(), pass);
-	memset(pass, 0, sizeof(pass));
+	r = QRBG_connect(host, port, user.c_str(), pass);
+	memset(pass, 0, strlen(pass));
 	
-	return get_int();    /* small test to check if we can get random bytes */
+	return r;
 }
-
+
+/* Starts the refill thread, which gets to work on the spare pool at once.
+   Has to happen after daemon(), threads don't survive a fork. */
+extern "C" void QRBG_start() {
+	pthread_t thread;
+	
+	pthread_mutex_lock(&pool_lock);
+	refilling = 1;
+	pthread_mutex_unlock(&pool_lock);
+	
+	if (pthread_create(&thread, NULL, refill_main, NULL)) {
+		std::cerr << "QRBG: Unable to start the refill thread." << endl;
+		std::exit(1);
+	}
+	pthread_detach(thread);
+}
+
 extern "C" int QRBG_get_int() {
-	return get_int();
+	int r;
+	
+	take_ints(&r, 1);
+	
+	return r;
 }
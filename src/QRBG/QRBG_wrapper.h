@@ -17,6 +17,10 @@
    You should have received a copy of the GNU General Public License
    along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
 
-int QRBG_init();
-
+int QRBG_connect(const char *host, unsigned int port, const char *user, const char *pass);
+
+int QRBG_init(const char *host, unsigned int port);
+
+void QRBG_start();
+
 int QRBG_get_int();
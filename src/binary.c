@@ -0,0 +1,111 @@
+/* binary.c - Encodes the frames of the binary protocol. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "binary.h"
+
+unsigned char *binary_put16(unsigned char *b, unsigned int v) {
+	b[0] = v >> 8;
+	b[1] = v;
+	return b + 2;
+}
+
+unsigned char *binary_put32(unsigned char *b, uint32_t v) {
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+	return b + 4;
+}
+
+unsigned int binary_get16(const unsigned char *b) {
+	return (b[0] << 8) | b[1];
+}
+
+uint32_t binary_get32(const unsigned char *b) {
+	return ((uint32_t) b[0] << 24) | ((uint32_t) b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* Writes the header of a frame with len bytes of payload, returns where
+   the payload goes */
+unsigned char *binary_frame(unsigned char *b, int type, size_t len) {
+	b = binary_put16(b, len + 1);
+	*b = type;
+	return b + 1;
+}
+
+/* A snapshot of the game, sent at every turn and on request */
+size_t binary_state(unsigned char *buf, game_t *g) {
+	unsigned char *b = buf + BINARY_HEADER, *count;
+	int i, len;
+	
+	*b++ = g->cturn;
+	*b++ = g->turns;
+	*b++ = g->over;
+	count = b++;
+	
+	*count = 0;
+	for (i = 0; i < MAX_PLAYERS; i++) {
+		if (!g->nicknames[i][0]) {
+			continue;
+		}
+		len = strlen(g->nicknames[i]);
+		*b++ = i;
+		*b++ = (g->alive >> i) & 1;
+		*b++ = len;
+		memcpy(b, g->nicknames[i], len);
+		b += len;
+		(*count)++;
+	}
+	
+	*b++ = g->planets;
+	for (i = 0; i < g->planets; i++) {
+		*b++ = g->board.x[i];
+		*b++ = g->board.y[i];
+		*b++ = (unsigned char) g->board.owner[i];
+		b = binary_put32(b, g->board.ships[i]);
+		b = binary_put32(b, g->board.prod[i]);
+		b = binary_put32(b, g->board.attack[i]);
+	}
+	
+	binary_frame(buf, BINARY_STATE, b - buf - BINARY_HEADER);
+	return b - buf;
+}
+
+/* The final scores, as engine_scores() left them */
+size_t binary_end(unsigned char *buf, game_t *g, int *scores, player_t *winner) {
+	unsigned char *b = buf + BINARY_HEADER;
+	int i;
+	
+	*b++ = winner->id;
+	*b++ = g->cplayers;
+	for (i = 0; i < g->cplayers; i++) {
+		*b++ = g->player_list[i]->id;
+		b = binary_put32(b, scores[g->player_list[i]->id + 1]);
+	}
+	
+	binary_frame(buf, BINARY_END, b - buf - BINARY_HEADER);
+	return b - buf;
+}
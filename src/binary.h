@@ -0,0 +1,84 @@
+/* binary.h - Binary protocol frames and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Every frame, either way, is a 16-bit length followed by that many bytes:
+   the frame type and its payload. Numbers are big-endian, nicknames and
+   text are not NUL-terminated. Requests map onto the same state machine
+   the telnet menus drive, so they're only accepted in the matching state
+   (see player_state_t). */
+#define BINARY_VERSION 1
+#define BINARY_HEADER 3                       /* length and type */
+#define BINARY_MAX_FRAME 65535
+
+/* Requests */
+#define BINARY_LIST 1       /* (menu) */
+#define BINARY_CREATE 2     /* (menu) u8 players, u8 planets, u8 turns */
+#define BINARY_JOIN 3       /* (menu) u32 game id */
+#define BINARY_NICK 4       /* (after join) nickname */
+#define BINARY_ORDERS 5     /* (your turn) u8 flags, then per order: u8 from,
+                               u8 to, u8 unit (see parse.h), u32 n */
+#define BINARY_BOARD 6      /* (in a game) */
+#define BINARY_LEAVE 7      /* (game over) */
+#define BINARY_QUIT 8
+
+#define BINARY_ORDERS_PASS 1    /* end the turn after these orders */
+#define BINARY_ORDER_SIZE 7
+
+/* Messages */
+#define BINARY_HELLO 0x80   /* u8 version */
+#define BINARY_REPLY 0x81   /* u8 request, u8 status, u8 state, u8 player id,
+                               u32 game id; request 0 is the server's own
+                               doing, like a lobby that expired */
+#define BINARY_GAMES 0x82   /* u16 count, then per game: u32 id, u8 players
+                               joined, u8 players, u8 planets, u8 turns,
+                               u8 open */
+#define BINARY_STATE 0x83   /* u8 turn, u8 turns, u8 over, u8 count, then per
+                               player: u8 id, u8 connected, u8 length,
+                               nickname; u8 planets, then per planet: u8 x,
+                               u8 y, i8 owner, u32 ships, u32 prod,
+                               u32 attack */
+#define BINARY_EVENTS 0x84  /* text, what telnet clients read as it happens */
+#define BINARY_ACK 0x85     /* u16 accepted, u16 rejected, then per rejected
+                               order: u16 index, i8 error (see do_move()) */
+#define BINARY_END 0x86     /* u8 winner id, u8 count, then per player: u8 id,
+                               u32 score */
+
+/* Reply status */
+#define BINARY_OK 0
+#define BINARY_FAILED 1         /* the game said no */
+#define BINARY_BAD_STATE 2      /* not now */
+#define BINARY_BAD_REQUEST 3    /* malformed or unknown request */
+
+#define BINARY_STATE_SIZE (BINARY_HEADER + 4 + MAX_PLAYERS * (3 + MAX_NICK_LEN) + \
+                           1 + MAX_PLANETS * 15)
+#define BINARY_END_SIZE (BINARY_HEADER + 2 + MAX_PLAYERS * 5)
+
+unsigned char *binary_put16(unsigned char *b, unsigned int v);
+
+unsigned char *binary_put32(unsigned char *b, uint32_t v);
+
+unsigned int binary_get16(const unsigned char *b);
+
+uint32_t binary_get32(const unsigned char *b);
+
+unsigned char *binary_frame(unsigned char *b, int type, size_t len);
+
+size_t binary_state(unsigned char *buf, game_t *g);
+
+size_t binary_end(unsigned char *buf, game_t *g, int *scores, player_t *winner);
@@ -0,0 +1,206 @@
+/* combat.c - Decides who is left standing when a fleet attacks a planet. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "rng.h"
+#include "combat.h"
+
+#define COMBAT_EVENT_LIMIT 16    /* fleets this small are fought loss by loss */
+#define BINOMIAL_DIRECT 16       /* binomials this small are drawn trial by trial */
+
+/* In every exchange a side loses a ship when (rng_int(rng) % 101) > its ratio */
+static double loss_chance(int ratio) {
+	if (ratio >= 100) {
+		return 0.0;
+	} else if (ratio < 0) {
+		return 1.0;
+	}
+	return (100 - ratio) / 101.0;
+}
+
+/* Standard normal, Marsaglia's polar method */
+static double draw_normal(rng_t *rng) {
+	double u, v, s;
+	
+	do {
+		u = 2 * rng_double(rng) - 1;
+		v = 2 * rng_double(rng) - 1;
+		s = u * u + v * v;
+	} while (s >= 1.0);
+	
+	return u * sqrt(-2 * log(s) / s);
+}
+
+/* Gamma(a, 1) for a >= 1, Marsaglia and Tsang's method */
+static double draw_gamma(rng_t *rng, double a) {
+	double d = a - 1.0 / 3, c = 1 / sqrt(9 * d), x, v, u;
+	
+	for (;;) {
+		do {
+			x = draw_normal(rng);
+			v = 1 + c * x;
+		} while (v <= 0);
+		v = v * v * v;
+		u = rng_double(rng);
+		if (u < 1 - 0.0331 * x * x * x * x ||
+		    log(u) < 0.5 * x * x + d * (1 - v + log(v))) {
+			return d * v;
+		}
+	}
+}
+
+static double draw_beta(rng_t *rng, double a, double b) {
+	double x = draw_gamma(rng, a);
+	
+	return x / (x + draw_gamma(rng, b));
+}
+
+/* Number of successes in n trials of probability p. Large n is halved with
+   Knuth's trick: the median of n uniforms is a beta variate, and whichever
+   side of it p falls on is again a binomial of half the size. Exact, and
+   O(log n) draws instead of n. */
+static int draw_binomial(rng_t *rng, int n, double p) {
+	int i, k = 0;
+	double x;
+	
+	while (n > BINOMIAL_DIRECT) {
+		i = 1 + n / 2;
+		x = draw_beta(rng, i, n + 1 - i);
+		if (x >= p) {
+			n = i - 1;
+			p /= x;
+		} else {
+			k += i;
+			n -= i;
+			p = (p - x) / (1 - x);
+		}
+	}
+	
+	for (i = 0; i < n; i++) {
+		if (rng_double(rng) < p) {
+			k++;
+		}
+	}
+	
+	return k;
+}
+
+/* Number of trials up to and including the first success, 0 < p <= 1 */
+static int draw_geometric(rng_t *rng, double p) {
+	if (p >= 1.0) {
+		return 1;
+	}
+	return 1 + (int) floor(log(rng_double(rng)) / log1p(-p));
+}
+
+/* The original engine. Costs two random numbers per exchange, which adds up
+   quickly with big fleets. */
+void combat_per_ship(int *attackers, int *defenders, int attack, int defense,
+                     rng_t *rng) {
+	/* Nobody can hit anybody, the fleet never gets through */
+	if (*attackers && *defenders && attack >= 100 && defense >= 100) {
+		*attackers = 0;
+		return;
+	}
+	
+	while (*attackers && *defenders) {
+		if ((rng_int(rng) % 101) > attack) {
+			(*attackers)--;
+		}
+		if (!*attackers) {
+			break;
+		}
+		if ((rng_int(rng) % 101) > defense) {
+			(*defenders)--;
+		}
+	}
+}
+
+/* Same outcome distribution as combat_per_ship(), but the exchanges are
+   never played one by one. While both sides have plenty of ships, k rounds
+   can't finish either of them off, so each side's losses over those rounds
+   are independent binomials. Once one side is down to a handful of ships we
+   jump from one of its losses to the next: the rounds in between are
+   geometric and the other side's losses during them binomial. A 50,000 ship
+   battle takes a few thousand random numbers instead of 100,000. */
+void combat_sampled(int *attackers, int *defenders, int attack, int defense,
+                    rng_t *rng) {
+	double pa = loss_chance(attack), pd = loss_chance(defense);
+	int a = *attackers, d = *defenders, k;
+	
+	if (a <= 0 || d <= 0) {
+		return;
+	}
+	
+	if (pa == 0.0) {
+		/* Attackers are untouchable, they win unless nobody can be hit */
+		if (pd == 0.0) {
+			a = 0;
+		} else {
+			d = 0;
+		}
+	} else if (pd == 0.0) {
+		a = 0;
+	}
+	
+	while (a > COMBAT_EVENT_LIMIT && d > COMBAT_EVENT_LIMIT) {
+		k = (a < d ? a : d) - 1;
+		a -= draw_binomial(rng, k, pa);
+		d -= draw_binomial(rng, k, pd);
+	}
+	
+	if (a <= d) {
+		/* Step from one attacker loss to the next. The defenders fire in
+		   every round before it, and in that round too if anyone is left. */
+		while (a && d) {
+			k = draw_binomial(rng, draw_geometric(rng, pa) - 1, pd);
+			if (k >= d) {
+				d = 0;
+				break;
+			}
+			d -= k;
+			if (!--a) {
+				break;
+			}
+			if (rng_double(rng) < pd) {
+				d--;
+			}
+		}
+	} else {
+		/* Step from one defender loss to the next. The attackers fire first
+		   in every round, including the one the defenders lose a ship in. */
+		while (a && d) {
+			k = draw_binomial(rng, draw_geometric(rng, pd) - 1, pa);
+			if (k >= a) {
+				a = 0;
+				break;
+			}
+			a -= k;
+			if (rng_double(rng) < pa && !--a) {
+				break;
+			}
+			d--;
+		}
+	}
+	
+	*attackers = a;
+	*defenders = d;
+}
@@ -0,0 +1,29 @@
+/* combat.h - Battle resolution function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define COMBAT_PER_SHIP 0    /* one exchange of fire at a time */
+#define COMBAT_SAMPLED 1     /* draw the outcome from the same distribution */
+
+/* Both engines fight it out between *attackers and *defenders and leave the
+   survivors behind. Exactly one side ends up with no ships. */
+void combat_per_ship(int *attackers, int *defenders, int attack, int defense,
+                     rng_t *rng);
+
+void combat_sampled(int *attackers, int *defenders, int attack, int defense,
+                    rng_t *rng);
@@ -0,0 +1,281 @@
+/* engine.c - Plays out the turns. Doesn't know about connections or text,
+   so that galactic-replay and galactic-bench can run the very same code. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "combat.h"
+#include "moves.h"
+#include "parse.h"
+#include "engine.h"
+
+/* Random events */
+#define EVENT_DRAWS 10    /* random numbers set aside per planet and turn */
+#define EVENT_PROD 1
+#define EVENT_ATTACK 2
+#define EVENT_DEFECT 4
+
+/* Scatters planets over the board, no two on the same spot */
+void engine_board(board_t *b, int planets, rng_t *r) {
+	int x, y, k = planets;
+	unsigned int used[BOARD_SIZE];      /* a bit per occupied column */
+
+	memset(used, 0, sizeof(used));
+	memset(b, 0, sizeof(board_t));
+
+	while (k) {
+		x = rng_int(r) % BOARD_SIZE;
+		y = rng_int(r) % BOARD_SIZE;
+		if (!(used[y] & (1u << x))) {
+			used[y] |= 1u << x;
+			k--;
+			b->x[k] = x;
+			b->y[k] = y;
+			b->owner[k] = NOBODY;
+			b->ships[k] = 20;
+			b->prod[k] = 10;
+			b->attack[k] = 40;
+		}
+	}
+}
+
+/* Hands every player a random neutral planet to start from */
+void engine_start(game_t *g, const int *seats) {
+	int i, j;
+
+	for (i = 0; i < g->players; i++) {
+		while (g->board.owner[(j = rng_int(&g->rng) % g->planets)] != NOBODY);
+		g->board.owner[j] = seats[i];
+	}
+}
+
+/* Sends ships from one planet to another, they arrive a turn for every
+   unit of distance later. Fleets that would land after the last turn there
+   could ever be are lost. */
+void engine_send(game_t *g, int player, int from, int to, int ships) {
+	int diffx, diffy, arrival_turn;
+
+	diffx = abs(g->board.x[to] - g->board.x[from]);
+	diffy = abs(g->board.y[to] - g->board.y[from]);
+	arrival_turn = floor(sqrt(diffx*diffx + diffy*diffy)) + g->cturn;
+	g->board.ships[from] -= ships;
+	if (arrival_turn <= MAX_TURNS) {
+		moves_add(&g->moves[arrival_turn & (MOVE_SLOTS - 1)], player, to, ships,
+		          g->board.attack[from]);
+	}
+}
+
+/* Carries out a player's order. Returns the ships that left, or minus one
+   of the reasons it can't be done:
+     1 invalid source planet, 2 the player doesn't own it,
+     3 invalid target planet, 4 invalid number of ships */
+int engine_order(game_t *g, int player, const order_t *o) {
+	int from = o->from, to = o->to, n = o->n;
+
+	if (from < 0 || from > g->planets - 1) {
+		return -1;
+	} else if (g->board.owner[from] != player) {
+		return -2;
+	}
+
+	if (to < 0 || to > g->planets - 1 || to == from) {
+		return -3;
+	}
+
+	if (o->unit == ORDER_PERCENT) {
+		if (n > 100) {
+			return -4;
+		}
+		n = g->board.ships[from] * n / 100;
+	}
+	if (n <= 0 || n > g->board.ships[from]) {
+		return -4;
+	}
+
+	engine_send(g, player, from, to, n);
+
+	return n;
+}
+
+/* Planets of players who left become neutral. report may be NULL. */
+void engine_orphans(game_t *g, void (*report)(const turn_event_t *e, void *data),
+                    void *data) {
+	int i, o;
+	unsigned int gone = 0;
+	turn_event_t e;
+
+	for (i = 0; i < g->planets; i++) {
+		o = g->board.owner[i];
+		if (o == NOBODY || (g->alive & (1u << o))) {
+			continue;
+		}
+		if (report && !(gone & (1u << o))) {
+			memset(&e, 0, sizeof(e));
+			e.kind = TURN_GONE;
+			e.planet = i;
+			e.player = e.owner = o;
+			report(&e, data);
+		}
+		gone |= 1u << o;
+		g->board.owner[i] = NOBODY;
+	}
+}
+
+/* Returns 1 with probability p%, given a fresh draw */
+static int do_it_faggot(int draw, int p) {
+	return draw % 100 < p;
+}
+
+static void report_event(int kind, int planet, int player, int owner, int value,
+                         int variant, void (*report)(const turn_event_t *e, void *data),
+                         void *data) {
+	turn_event_t e;
+
+	e.kind = kind;
+	e.planet = planet;
+	e.player = player;
+	e.owner = owner;
+	e.value = value;
+	e.variant = variant;
+	report(&e, data);
+}
+
+/* Ends the current turn: random events, production, then the fleets due
+   this turn land. */
+void engine_turn(game_t *g, const int *seats, int nseats, int combat_mode,
+                 void (*report)(const turn_event_t *e, void *data), void *data) {
+	int i, o, r, t, defense;
+	int draws[MAX_PLANETS][EVENT_DRAWS], rolls[MAX_PLANETS], *d;
+	move_batch_t *b = &g->moves[g->cturn & (MOVE_SLOTS - 1)];
+	move_t *m;
+	int diff;
+
+	engine_orphans(g, report, data);
+
+	/* Everything the random events could need this turn is drawn at once,
+	   then every planet is rolled for in a single sweep. */
+	rng_fill(&g->rng, &draws[0][0], g->planets * EVENT_DRAWS);
+	for (i = 0; i < g->planets; i++) {
+		rolls[i] = do_it_faggot(draws[i][0], 10) * EVENT_PROD |
+		           do_it_faggot(draws[i][4], 10) * EVENT_ATTACK |
+		           do_it_faggot(draws[i][8], 1) * EVENT_DEFECT;
+	}
+
+	for (i = 0; i < g->planets; i++) {
+		d = draws[i];
+		o = g->board.owner[i];
+
+		if (o != NOBODY && (rolls[i] & EVENT_PROD)) {
+			r = (d[1] % 50) + 1;
+			diff = ceil((g->board.prod[i] * r) / 100);
+			if (diff) {
+				if (do_it_faggot(d[2], 50)) {
+					g->board.prod[i] -= diff;
+					r = -r;
+				} else {
+					g->board.prod[i] += diff;
+				}
+				report_event(TURN_PROD, i, o, o, r, d[3] % 3, report, data);
+			}
+		}
+
+		if (o != NOBODY && (rolls[i] & EVENT_ATTACK)) {
+			r = (d[5] % 50) + 1;
+			diff = ceil((g->board.attack[i] * r) / 100);
+			if (diff) {
+				if (do_it_faggot(d[6], 50)) {
+					g->board.attack[i] -= diff;
+					r = -r;
+				} else {
+					g->board.attack[i] += diff;
+				}
+				report_event(TURN_ATTACK, i, o, o, r, d[7] % 3, report, data);
+			}
+		}
+
+		if (o != NOBODY && (rolls[i] & EVENT_DEFECT) && nseats > 1) {
+			/* Pick among everybody but the current owner */
+			for (t = 0; t < nseats && seats[t] != o; t++);
+			r = d[9] % (nseats - 1);
+			if (r >= t) {
+				r++;
+			}
+			g->board.owner[i] = seats[r];
+			report_event(TURN_DEFECT, i, seats[r], o, 0, 0, report, data);
+		}
+	}
+
+	/* Produce new ships */
+	for (i = 0; i < g->planets; i++) {
+		g->board.ships[i] += g->board.owner[i] != NOBODY ? g->board.prod[i] : 0;
+	}
+
+	g->cturn++;
+
+	for (i = 0; i < b->count; i++) {
+		m = &b->moves[i];
+		t = m->target;
+		o = g->board.owner[t];
+		if (!(g->alive & (1u << m->owner))) {
+			continue;                  /* the fleet of somebody who left */
+		}
+		if (o == m->owner) {
+			g->board.ships[t] += m->ships;
+			report_event(TURN_REINFORCE, t, m->owner, o, m->ships, 0, report, data);
+			continue;
+		}
+
+		defense = g->board.attack[t] + (rng_int(&g->rng) % 16);
+		if (combat_mode == COMBAT_SAMPLED) {
+			combat_sampled(&m->ships, &g->board.ships[t], m->attack, defense, &g->rng);
+		} else {
+			combat_per_ship(&m->ships, &g->board.ships[t], m->attack, defense, &g->rng);
+		}
+
+		if (m->ships) {
+			g->board.owner[t] = m->owner;
+			g->board.ships[t] = m->ships;
+			if (o == NOBODY) {
+				g->board.prod[t] = 10;
+			}
+			report_event(TURN_CONQUER, t, m->owner, o, m->ships, 0, report, data);
+		} else {
+			report_event(TURN_REPELLED, t, m->owner, o, g->board.ships[t], 0, report, data);
+		}
+	}
+	moves_reset(b);
+}
+
+/* Scores every player in one sweep over the planets: ships times attack
+   ratio, summed per owner. scores[id + 1] is player id's score, the extra
+   lane in front takes the neutral planets so the loop needs no branch. */
+void engine_scores(game_t *g, int scores[MAX_PLAYERS + 1]) {
+	int i;
+
+	memset(scores, 0, (MAX_PLAYERS + 1) * sizeof(int));
+	for (i = 0; i < g->planets; i++) {
+		scores[g->board.owner[i] + 1] += g->board.ships[i] * g->board.attack[i];
+	}
+}
@@ -0,0 +1,53 @@
+/* engine.h - The rules of the game, with nobody connected. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Whatever engine_turn() does to the board is reported as one of these.
+   owner is who had the planet before, the rest depends on the kind. */
+#define TURN_GONE 1          /* player left, their planets went neutral */
+#define TURN_PROD 2          /* value is the change in production, in % */
+#define TURN_ATTACK 3        /* value is the change in attack ratio, in % */
+#define TURN_DEFECT 4        /* the planet now belongs to player */
+#define TURN_REINFORCE 5     /* value of player's ships landed */
+#define TURN_CONQUER 6       /* player took the planet, value ships left */
+#define TURN_REPELLED 7      /* player's fleet was wiped out, value ships
+                                are left defending */
+
+typedef struct turn_event_s {
+	int kind, planet, player, owner;
+	int value;
+	int variant;             /* picks one of the ways to word it */
+} turn_event_t;
+
+void engine_board(board_t *b, int planets, rng_t *r);
+
+/* Seats are the ids of the players still in the game, in the order they
+   are listed in, which decides who a defecting planet goes to. */
+void engine_start(game_t *g, const int *seats);
+
+void engine_send(game_t *g, int player, int from, int to, int ships);
+
+int engine_order(game_t *g, int player, const order_t *o);
+
+void engine_orphans(game_t *g, void (*report)(const turn_event_t *e, void *data),
+                    void *data);
+
+void engine_turn(game_t *g, const int *seats, int nseats, int combat_mode,
+                 void (*report)(const turn_event_t *e, void *data), void *data);
+
+void engine_scores(game_t *g, int scores[MAX_PLAYERS + 1]);
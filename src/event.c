@@ -0,0 +1,210 @@
+/* event.c - Readiness notification for our sockets. Uses edge-triggered
+   epoll where available and falls back to plain old select(). */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#include "common.h"
+#include "event.h"
+
+struct event_loop_s {
+	int epfd;                       /* -1 when using the select backend */
+
+	/* select backend */
+	int maxfd;
+	fd_set rset, wset;
+	void *data[FD_SETSIZE];
+};
+
+event_loop_t *event_loop_new() {
+	event_loop_t *loop;
+
+	if (!(loop = malloc(sizeof(event_loop_t)))) {
+		exit_with("malloc error", 1);
+	}
+
+	loop->epfd = -1;
+	loop->maxfd = -1;
+	FD_ZERO(&loop->rset);
+	FD_ZERO(&loop->wset);
+	memset(loop->data, 0, sizeof(loop->data));
+
+#if HAVE_SYS_EPOLL_H
+	/* If the kernel lacks epoll we silently stay on select */
+	loop->epfd = epoll_create(1024);
+#endif
+
+	return loop;
+}
+
+const char *event_loop_backend(event_loop_t *loop) {
+	return loop->epfd < 0 ? "select" : "epoll";
+}
+
+#if HAVE_SYS_EPOLL_H
+static int epoll_ctl_events(event_loop_t *loop, int op, int fd, int events, void *data) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLET;
+	if (events & EV_READ) {
+		ev.events |= EPOLLIN;
+	}
+	if (events & EV_WRITE) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.ptr = data;
+
+	return epoll_ctl(loop->epfd, op, fd, &ev);
+}
+#endif
+
+static int select_set_events(event_loop_t *loop, int fd, int events, void *data) {
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	FD_CLR(fd, &loop->rset);
+	FD_CLR(fd, &loop->wset);
+	if (events & EV_READ) {
+		FD_SET(fd, &loop->rset);
+	}
+	if (events & EV_WRITE) {
+		FD_SET(fd, &loop->wset);
+	}
+	loop->data[fd] = data;
+	if (fd > loop->maxfd) {
+		loop->maxfd = fd;
+	}
+
+	return 0;
+}
+
+int event_add(event_loop_t *loop, int fd, int events, void *data) {
+#if HAVE_SYS_EPOLL_H
+	if (loop->epfd >= 0) {
+		return epoll_ctl_events(loop, EPOLL_CTL_ADD, fd, events, data);
+	}
+#endif
+	return select_set_events(loop, fd, events, data);
+}
+
+int event_mod(event_loop_t *loop, int fd, int events, void *data) {
+#if HAVE_SYS_EPOLL_H
+	if (loop->epfd >= 0) {
+		return epoll_ctl_events(loop, EPOLL_CTL_MOD, fd, events, data);
+	}
+#endif
+	return select_set_events(loop, fd, events, data);
+}
+
+int event_del(event_loop_t *loop, int fd) {
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+
+	if (loop->epfd >= 0) {
+		return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+	}
+#endif
+	if (fd < 0 || fd >= FD_SETSIZE) {
+		errno = EBADF;
+		return -1;
+	}
+
+	FD_CLR(fd, &loop->rset);
+	FD_CLR(fd, &loop->wset);
+	loop->data[fd] = NULL;
+	while (loop->maxfd >= 0 && !loop->data[loop->maxfd]) {
+		loop->maxfd--;
+	}
+
+	return 0;
+}
+
+/* Waits up to timeout milliseconds (forever if negative) and fills fired[]
+   with the data pointers of the ready descriptors. Returns the number of
+   entries filled, 0 on timeout or -1 on error. */
+int event_wait(event_loop_t *loop, fired_event_t *fired, int max, int timeout) {
+	int fd, n, nready;
+	fd_set rset, wset;
+	struct timeval tv;
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event events[MAX_FIRED_EVENTS];
+
+	if (loop->epfd >= 0) {
+		if (max > MAX_FIRED_EVENTS) {
+			max = MAX_FIRED_EVENTS;
+		}
+
+		nready = epoll_wait(loop->epfd, events, max, timeout);
+
+		for (n = 0; n < nready; n++) {
+			fired[n].data = events[n].data.ptr;
+			fired[n].events = 0;
+			/* Errors and hangups are reported as readable so the
+			   owner notices them on its next read() */
+			if (events[n].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				fired[n].events |= EV_READ;
+			}
+			if (events[n].events & EPOLLOUT) {
+				fired[n].events |= EV_WRITE;
+			}
+		}
+
+		return (nready < 0 && errno == EINTR) ? 0 : nready;
+	}
+#endif
+
+	rset = loop->rset;
+	wset = loop->wset;
+	if (timeout >= 0) {
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+	}
+
+	nready = select(loop->maxfd + 1, &rset, &wset, NULL, timeout >= 0 ? &tv : NULL);
+
+	if (nready < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (fd = n = 0; fd <= loop->maxfd && n < max && nready > 0; fd++) {
+		if (FD_ISSET(fd, &rset) || FD_ISSET(fd, &wset)) {
+			fired[n].data = loop->data[fd];
+			fired[n].events = (FD_ISSET(fd, &rset) ? EV_READ : 0) |
+			                  (FD_ISSET(fd, &wset) ? EV_WRITE : 0);
+			n++;
+			nready--;
+		}
+	}
+
+	return n;
+}
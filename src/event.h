@@ -0,0 +1,42 @@
+/* event.h - Event loop structures and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define EV_READ  1
+#define EV_WRITE 2
+
+#define MAX_FIRED_EVENTS 256
+
+typedef struct fired_event_s {
+	void *data;
+	int events;
+} fired_event_t;
+
+typedef struct event_loop_s event_loop_t;
+
+event_loop_t *event_loop_new();
+
+const char *event_loop_backend(event_loop_t *loop);
+
+int event_add(event_loop_t *loop, int fd, int events, void *data);
+
+int event_mod(event_loop_t *loop, int fd, int events, void *data);
+
+int event_del(event_loop_t *loop, int fd);
+
+int event_wait(event_loop_t *loop, fired_event_t *fired, int max, int timeout);
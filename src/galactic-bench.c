@@ -0,0 +1,186 @@
+/* galactic-bench.c - Plays lots of games between bots that send ships
+   about at random, to see how fast the turn engine goes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "combat.h"
+#include "moves.h"
+#include "parse.h"
+#include "engine.h"
+
+typedef struct bench_s {
+	int players, planets, turns, combat_mode;
+	long played, orders, events;
+	uint32_t checksum;            /* of every final score, FNV-1a */
+} bench_t;
+
+static void count_event(const turn_event_t *e, void *data) {
+	(void) e;
+	((bench_t *) data)->events++;
+}
+
+/* Every bot sends half the ships on about half its planets somewhere else */
+static void play_orders(bench_t *bench, game_t *g, rng_t *bot) {
+	order_t o;
+	int i;
+
+	o.unit = ORDER_PERCENT;
+	o.n = 50;
+	for (i = 0; i < g->planets; i++) {
+		if (g->board.owner[i] == NOBODY || rng_int(bot) & 1) {
+			continue;
+		}
+		o.from = i;
+		o.to = rng_int(bot) % (g->planets - 1);
+		if (o.to >= i) {
+			o.to++;
+		}
+		if (engine_order(g, g->board.owner[i], &o) > 0) {
+			bench->orders++;
+		}
+	}
+}
+
+static void play_game(bench_t *bench, uint64_t seed, rng_t *bot) {
+	game_t *g;
+	int i, seats[MAX_PLAYERS], scores[MAX_PLAYERS + 1];
+
+	if (!(g = calloc(1, sizeof(game_t)))) {
+		exit_with("calloc error", 1);
+	}
+	g->players = g->cplayers = bench->players;
+	g->planets = bench->planets;
+	g->turns = bench->turns;
+	g->cturn = 1;
+	g->alive = (1u << g->players) - 1;
+	for (i = 0; i < g->players; i++) {
+		seats[i] = i;
+	}
+
+	rng_seed(&g->rng, seed);
+	engine_board(&g->board, g->planets, &g->rng);
+	engine_start(g, seats);
+
+	while (g->cturn <= g->turns) {
+		play_orders(bench, g, bot);
+		engine_turn(g, seats, g->players, bench->combat_mode, count_event, bench);
+		bench->played++;
+	}
+
+	engine_scores(g, scores);
+	for (i = 0; i <= g->players; i++) {
+		bench->checksum = (bench->checksum ^ (uint32_t) scores[i]) * 16777619u;
+	}
+
+	for (i = 0; i < MOVE_SLOTS; i++) {
+		moves_free(&g->moves[i]);
+	}
+	free(g);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-g games] [-p players] [-P planets] [-t turns]"
+	        " [-s seed] [-c per-ship|sampled]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	bench_t bench;
+	rng_t bot;
+	uint64_t seed = 1, x;
+	int opt, i, games = 10000;
+	struct timespec t0, t1;
+	double secs;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.players = 4;
+	bench.planets = MAX_PLANETS;
+	bench.turns = 50;
+	bench.combat_mode = COMBAT_PER_SHIP;
+	bench.checksum = 2166136261u;
+
+	while ((opt = getopt(argc, argv, "g:p:P:t:s:c:")) != -1) {
+		switch (opt) {
+			case 'g':
+				games = atoi(optarg);
+				break;
+			case 'p':
+				bench.players = atoi(optarg);
+				break;
+			case 'P':
+				bench.planets = atoi(optarg);
+				break;
+			case 't':
+				bench.turns = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'c':
+				if (!strcmp(optarg, "sampled")) {
+					bench.combat_mode = COMBAT_SAMPLED;
+				} else if (!strcmp(optarg, "per-ship")) {
+					bench.combat_mode = COMBAT_PER_SHIP;
+				} else {
+					usage(argv[0]);
+				}
+				break;
+			default:
+			case '?':
+				usage(argv[0]);
+		}
+	}
+	if (games < 1 || bench.players < 2 || bench.players > MAX_PLAYERS ||
+	    bench.planets < bench.players || bench.planets > MAX_PLANETS ||
+	    bench.turns < 1 || bench.turns > MAX_TURNS) {
+		usage(argv[0]);
+	}
+
+	/* Same seed, same games, same checksum: the engine has to be
+	   deterministic for replays to work */
+	x = seed;
+	rng_seed(&bot, rng_splitmix(&x));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < games; i++) {
+		play_game(&bench, rng_splitmix(&x), &bot);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("%d games, %ld turns, %ld orders, %ld events in %.3f s\n", games,
+	       bench.played, bench.orders, bench.events, secs);
+	printf("%.0f turns/s, checksum %08x\n", bench.played / secs,
+	       (unsigned int) bench.checksum);
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+/* galactic-replay.c - Plays a logged game again, with nobody connected,
+   and checks that it comes out the way it did on the server. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "moves.h"
+#include "parse.h"
+#include "engine.h"
+#include "binary.h"
+#include "replay.h"
+
+#define REPLAY_HEADER 53          /* up to the planets */
+
+static const char *event_names[] = {
+	"?", "gone", "prod", "attack", "defect", "reinforce", "conquer", "repelled"
+};
+
+/* Where engine_turn() is up to in the log, see check_event() */
+typedef struct cursor_s {
+	const unsigned char *p, *end;
+	game_t *g;
+	int verbose;
+	const char *error;        /* set on the first thing that doesn't match */
+	int cut;                  /* the log ends halfway through the turn */
+} cursor_t;
+
+static uint64_t get64(const unsigned char *b) {
+	return ((uint64_t) binary_get32(b) << 32) | binary_get32(b + 4);
+}
+
+static unsigned char *load_file(const char *path, size_t *len) {
+	FILE *f;
+	unsigned char *data;
+	long size;
+
+	if (!(f = fopen(path, "rb"))) {
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0) {
+		fclose(f);
+		return NULL;
+	}
+	if (!(data = malloc(size + 1))) {
+		exit_with("malloc error", 1);
+	}
+	if (fread(data, 1, size, f) != (size_t) size) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	*len = size;
+
+	return data;
+}
+
+/* Sets g up from the header, the way it was right before engine_start().
+   Returns where the records begin, NULL if the header doesn't make sense. */
+static const unsigned char *read_header(game_t *g, const unsigned char *b,
+                                        const unsigned char *end, int *seats,
+                                        int *combat_mode) {
+	int i, n;
+
+	if (end - b < REPLAY_HEADER || binary_get32(b) != REPLAY_MAGIC) {
+		return NULL;
+	}
+	g->id = binary_get32(b + 4);
+	g->players = b[8];
+	g->planets = b[9];
+	g->turns = b[10];
+	g->cturn = b[11];
+	*combat_mode = b[12];
+	g->rng.seed = get64(b + 13);
+	for (i = 0; i < 4; i++) {
+		g->rng.s[i] = get64(b + 21 + 8 * i);
+	}
+	b += REPLAY_HEADER;
+
+	if (g->players < 2 || g->players > MAX_PLAYERS || g->planets < g->players ||
+	    g->planets > MAX_PLANETS || g->turns > MAX_TURNS || g->cturn < 1) {
+		return NULL;
+	}
+
+	if (end - b < 15 * g->planets + 1) {
+		return NULL;
+	}
+	for (i = 0; i < g->planets; i++) {
+		g->board.x[i] = b[0];
+		g->board.y[i] = b[1];
+		g->board.owner[i] = (signed char) b[2];
+		g->board.ships[i] = binary_get32(b + 3);
+		g->board.prod[i] = binary_get32(b + 7);
+		g->board.attack[i] = binary_get32(b + 11);
+		if (g->board.x[i] >= BOARD_SIZE || g->board.y[i] >= BOARD_SIZE ||
+		    g->board.owner[i] != NOBODY) {
+			return NULL;
+		}
+		b += 15;
+	}
+
+	if (*b++ != g->players) {
+		return NULL;
+	}
+	for (i = 0; i < g->players; i++) {
+		if (end - b < 2 || b[0] >= g->players || b[1] > MAX_NICK_LEN || end - b < 2 + b[1]) {
+			return NULL;
+		}
+		seats[i] = n = b[0];
+		memcpy(g->nicknames[n], b + 2, b[1]);
+		g->nicknames[n][b[1]] = '\0';
+		b += 2 + b[1];
+	}
+	g->alive = (1u << g->players) - 1;
+	g->cplayers = g->players;
+
+	return b;
+}
+
+static void print_event(game_t *g, const turn_event_t *e) {
+	printf("turn %d: %-9s %c", g->cturn, event_names[e->kind], 'A' + e->planet);
+	if (e->player != NOBODY) {
+		printf(" %s", g->nicknames[e->player]);
+	}
+	if (e->owner != NOBODY && e->owner != e->player) {
+		printf(" (from %s)", g->nicknames[e->owner]);
+	}
+	if (e->value) {
+		printf(" %d", e->value);
+	}
+	printf("\n");
+}
+
+/* What engine_turn() does has to be what the server logged next */
+static void check_event(const turn_event_t *e, void *data) {
+	cursor_t *c = (cursor_t *) data;
+	const unsigned char *b = c->p;
+
+	if (c->verbose) {
+		print_event(c->g, e);
+	}
+	if (c->error || c->cut) {
+		return;
+	}
+	if (c->end - b < 10) {
+		c->cut = 1;
+		return;
+	}
+	if (b[0] != REPLAY_EVENT) {
+		c->error = "event that wasn't logged";
+		return;
+	}
+	if (b[1] != e->kind || b[2] != e->planet || (signed char) b[3] != e->player ||
+	    (signed char) b[4] != e->owner || b[5] != e->variant ||
+	    (int) binary_get32(b + 6) != e->value) {
+		c->error = "event differs from the log";
+		return;
+	}
+	c->p += 10;
+}
+
+/* Plays the game in data through, counting the turns played in *turns.
+   Returns 1 if it came out the way the log says, 0 if it did as far as the
+   log goes but that's not the end of it (the server went down, say, maybe
+   halfway through a record), -1 if it didn't. */
+static int replay_game(const char *path, const unsigned char *data, size_t len,
+                       int verbose, long *turns) {
+	game_t *g;
+	cursor_t c;
+	const unsigned char *b, *end = data + len;
+	const char *error = NULL;
+	order_t o;
+	int i, n, combat_mode, scores[MAX_PLAYERS + 1];
+	int seats[MAX_PLAYERS], finished = 0;
+
+	if (!(g = calloc(1, sizeof(game_t)))) {
+		exit_with("calloc error", 1);
+	}
+	if (!(b = read_header(g, data, end, seats, &combat_mode))) {
+		error = "bad header";
+		b = data;
+		goto out;
+	}
+	engine_start(g, seats);
+
+	c.end = end;
+	c.g = g;
+	c.verbose = verbose;
+	c.error = NULL;
+	c.cut = 0;
+
+	while (b < end && !error) {
+		switch (*b) {
+			case REPLAY_ORDER:
+				if (end - b < 8) {
+					b = end;
+					break;
+				}
+				o.from = b[2];
+				o.to = b[3];
+				o.n = binary_get32(b + 4);
+				o.unit = ORDER_SHIPS;
+				if (engine_order(g, b[1], &o) < 0) {
+					error = "order the board doesn't allow";
+					break;
+				}
+				b += 8;
+				break;
+			case REPLAY_TURN:
+				if (end - b < 4 || end - b < 4 + b[3]) {
+					b = end;
+					break;
+				}
+				if ((n = b[3]) > g->players) {
+					error = "bad turn";
+					break;
+				}
+				g->alive = binary_get16(b + 1);
+				for (i = 0; i < n && b[4 + i] < g->players; i++) {
+					seats[i] = b[4 + i];
+				}
+				if (i < n || g->alive >> g->players) {
+					error = "bad turn";
+					break;
+				}
+				c.p = b + 4 + n;
+				engine_turn(g, seats, n, combat_mode, check_event, &c);
+				(*turns)++;
+				error = c.error;
+				b = c.cut ? end : c.p;
+				break;
+			case REPLAY_END:
+				if (end - b < 4 || end - b < 4 + 4 * b[3]) {
+					b = end;
+					break;
+				}
+				if (b[3] != g->players || end - b != 4 + 4 * g->players) {
+					error = "bad end";
+					break;
+				}
+				g->alive = binary_get16(b + 1);
+				engine_orphans(g, NULL, NULL);
+				engine_scores(g, scores);
+				for (i = 0; i < g->players; i++) {
+					if (verbose) {
+						printf("%-20s %d\n", g->nicknames[i], scores[i + 1]);
+					}
+					if ((int) binary_get32(b + 4 + 4 * i) != scores[i + 1]) {
+						error = "scores differ from the log";
+					}
+				}
+				finished = 1;
+				b = end;
+				break;
+			case REPLAY_EVENT:
+				error = "logged event that didn't happen";
+				break;
+			default:
+				error = "unknown record";
+				break;
+		}
+	}
+
+out:
+	if (error) {
+		fprintf(stderr, "%s: turn %d, offset %ld: %s\n", path, g->cturn,
+		        (long) (b - data), error);
+	}
+	for (i = 0; i < MOVE_SLOTS; i++) {
+		moves_free(&g->moves[i]);
+	}
+	free(g);
+
+	return error ? -1 : finished;
+}
+
+int main(int argc, char **argv) {
+	int opt, i, r = 0, repeat = 1, verbose = 0, result = 0;
+	unsigned char *data;
+	size_t len;
+	long turns;
+	struct timespec t0, t1;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "vn:")) != -1) {
+		switch (opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				repeat = atoi(optarg);
+				break;
+			default:
+			case '?':
+				fprintf(stderr, "Usage: %s [-v] [-n times] file.replay...\n", argv[0]);
+				exit(1);
+		}
+	}
+	if (optind == argc || repeat < 1) {
+		fprintf(stderr, "Usage: %s [-v] [-n times] file.replay...\n", argv[0]);
+		exit(1);
+	}
+
+	for (; optind < argc; optind++) {
+		if (!(data = load_file(argv[optind], &len))) {
+			perror(argv[optind]);
+			r = 1;
+			continue;
+		}
+
+		/* Playing it again and again is how the turn engine gets profiled */
+		turns = 0;
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < repeat; i++) {
+			if ((result = replay_game(argv[optind], data, len, verbose && !i, &turns)) < 0) {
+				r = 1;
+				break;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		free(data);
+
+		if (i < repeat) {
+			continue;
+		}
+		if (repeat > 1) {
+			secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+			printf("%s: %ld turns in %.3f s, %.0f turns/s\n", argv[optind], turns,
+			       secs, turns / secs);
+		} else {
+			printf("%s: %s\n", argv[optind], result ? "ok" : "ok so far, no end");
+		}
+	}
+
+	return r;
+}
@@ -24,7 +24,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <signal.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -35,111 +40,296 @@
 #include <math.h>
 #include <getopt.h>
 #include <errno.h>
-#include <regex.h>
 #include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "seed.h"
+#include "wheel.h"
 #include "galacticd.h"
 #include "scoreboard.h"
+#include "event.h"
+#include "shard.h"
+#include "registry.h"
+#include "combat.h"
+#include "moves.h"
+#include "parse.h"
+#include "engine.h"
+#include "screen.h"
+#include "binary.h"
+#include "journal.h"
+#include "replay.h"
 #include "QRBG/QRBG_wrapper.h"
 
 #define DFLPORT 8000
-#define LISTENQ 10
+#define QRBG_HOST "random.irb.hr"
+#define QRBG_PORT 1227
+#define LISTENQ SOMAXCONN
+#define BCAST_MIN_SIZE 1024
+
+/* Default timeouts in seconds, 0 turns them off */
+#define TURN_TIME 300     /* then everybody who hasn't passed yet does */
+#define IDLE_TIME 1800    /* then the connection is closed */
+#define LOBBY_TIME 3600   /* for a game to fill up, then it's called off */
+#define LOBBY_GRACE 30    /* for stragglers still picking a nickname */
+#define MAX_TIME (14 * 24 * 3600)
+#define FLUSH_INTERVAL 1000    /* ms between scoreboard commits */
 
 static int really_random = 0;
+static int combat_mode = COMBAT_PER_SHIP;
+static int turn_time = TURN_TIME, idle_time = IDLE_TIME, lobby_time = LOBBY_TIME;
+
+static shard_t shards[MAX_SHARDS];
+static int nshards = 1;
+
+/* games_lock protects the registry itself as well as the fields of each game
+   that are visible from other shards (cplayers and open). Everything else in a
+   game_t belongs to the shard the game is pinned to, which is also the only
+   one allowed to remove it. */
+static pthread_mutex_t games_lock = PTHREAD_MUTEX_INITIALIZER;
+static registry_t games;
+
 
-static int random_int() {
-	return really_random ? abs(QRBG_get_int()) : random();
+static void mark_player_dirty(player_t *p) {
+	shard_t *s = &shards[p->shard];
+	
+	if (!p->dirty) {
+		p->dirty = 1;
+		p->dirty_prev = NULL;
+		p->dirty_next = s->dirty;
+		if (s->dirty) {
+			s->dirty->dirty_prev = p;
+		}
+		s->dirty = p;
+	}
 }
 
-static void send_to_all_players(game_t *g, char *msg) {
+static void unmark_player_dirty(player_t *p) {
+	shard_t *s = &shards[p->shard];
+	
+	if (p->dirty) {
+		if (p->dirty_prev) {
+			p->dirty_prev->dirty_next = p->dirty_next;
+		} else {
+			s->dirty = p->dirty_next;
+		}
+		if (p->dirty_next) {
+			p->dirty_next->dirty_prev = p->dirty_prev;
+		}
+		p->dirty = 0;
+	}
+}
+
+/* Queues output for the player. It's written out in one go when the shard
+   is done with its current batch of events. */
+static void player_queue(player_t *p, const char *buf, size_t len) {
+	if (p->fd < 0 || p->closing) {
+		return;
+	}
+	
+	outq_append(&p->outq, buf, len);
+	if (outq_pending(&p->outq) > OUTQ_HIGH_WATER) {
+		p->closing = 1;    /* not reading what we send, drop them */
+	}
+	mark_player_dirty(p);
+}
+
+/* Like player_queue(), but the player's queue only keeps a reference */
+static void player_queue_shared(player_t *p, shared_t *b) {
+	if (p->fd < 0 || p->closing) {
+		return;
+	}
+	
+	outq_append_shared(&p->outq, b);
+	if (outq_pending(&p->outq) > OUTQ_HIGH_WATER) {
+		p->closing = 1;
+	}
+	mark_player_dirty(p);
+}
+
+/* Text is for telnet clients, binary ones get frames instead */
+void player_send(player_t *p, const char *buf, size_t len) {
+	if (!p->binary) {
+		player_queue(p, buf, len);
+	}
+}
+
+void player_print(player_t *p, const char *msg) {
+	player_send(p, msg, strlen(msg));
+}
+
+static void player_send_shared(player_t *p, shared_t *b) {
+	if (!p->binary) {
+		player_queue_shared(p, b);
+	}
+}
+
+static void player_send_frame(player_t *p, const unsigned char *buf, size_t len) {
+	if (p->binary) {
+		player_queue(p, (const char *) buf, len);
+	}
+}
+
+static void player_send_shared_frame(player_t *p, shared_t *b) {
+	if (p->binary) {
+		player_queue_shared(p, b);
+	}
+}
+
+static void binary_reply(player_t *p, int request, int status, int game_id) {
+	unsigned char frame[BINARY_HEADER + 8], *b;
+	
+	b = binary_frame(frame, BINARY_REPLY, 8);
+	*b++ = request;
+	*b++ = status;
+	*b++ = p->state;
+	*b++ = p->in_game > 0 ? p->id : 0;
+	binary_put32(b, game_id);
+	player_send_frame(p, frame, sizeof(frame));
+}
+
+static void binary_reply_join(player_t *p, int game_id) {
+	binary_reply(p, BINARY_JOIN, p->state == JOIN_GAME_2 ? BINARY_OK : BINARY_FAILED,
+	             game_id);
+}
+
+/* Whether anyone in the game needs frames, so they're only built if so */
+static int game_has_binary_players(game_t *g) {
 	int i;
 	
 	for (i = 0; i < g->cplayers; i++) {
-		if (g->player_list[i]) {
-			write(g->player_list[i]->fd, msg, strlen(msg));
+		if (g->player_list[i] && g->player_list[i]->binary) {
+			return 1;
 		}
 	}
+	return 0;
 }
 
-static void generate_topology(player_t *p) {
-	int x, y, k = p->new_game_planets;
+/* Adds msg to the text every player of the game is going to get. It piles
+   up in a single buffer until broadcast_flush() hands it out. */
+static void broadcast(game_t *g, const char *msg) {
+	if (!g->bcast) {
+		g->bcast = shared_new(BCAST_MIN_SIZE);
+	}
+	shared_append(g->bcast, msg, strlen(msg));
+}
+
+static void broadcast_flush(game_t *g) {
+	int i;
+	unsigned char header[BINARY_HEADER];
+	shared_t *frame = NULL;
 	
-	for (y = 0; y < BOARD_SIZE; y++) {
-		for (x = 0; x < BOARD_SIZE; x++) {
-			p->new_game_board->nodes[y][x].name = '.';
-		}
+	if (!g->bcast) {
+		return;
+	}
+	
+	if (game_has_binary_players(g) && g->bcast->len < BINARY_MAX_FRAME) {
+		frame = shared_new(BINARY_HEADER + g->bcast->len);
+		binary_frame(header, BINARY_EVENTS, g->bcast->len);
+		shared_append(frame, (char *) header, BINARY_HEADER);
+		shared_append(frame, g->bcast->data, g->bcast->len);
 	}
 	
-	while (k) {
-		x = random_int() % BOARD_SIZE;
-		y = random_int() % BOARD_SIZE;
-		if (p->new_game_board->nodes[y][x].name == '.') {
-			p->new_game_board->nodes[y][x].name = (char) 'A' + k - 1;
-			p->new_game_board->nodes[y][x].x = x;
-			p->new_game_board->nodes[y][x].y = y;
-			p->new_game_board->nodes[y][x].owner = NULL;
-			p->new_game_board->nodes[y][x].ships = 20;
-			p->new_game_board->nodes[y][x].prod = 10;
-			p->new_game_board->nodes[y][x].attack = 40;
-			k--;
+	for (i = 0; i < g->cplayers; i++) {
+		if (g->player_list[i]) {
+			player_send_shared(g->player_list[i], g->bcast);
+			if (frame) {
+				player_send_shared_frame(g->player_list[i], frame);
+			}
 		}
 	}
+	shared_release(g->bcast);
+	g->bcast = NULL;
+	if (frame) {
+		shared_release(frame);
+	}
+}
+
+static void send_to_all_players(game_t *g, char *msg) {
+	broadcast(g, msg);
+	broadcast_flush(g);
 }
 
-static void draw_topology(char *r, board_t *b) {
-	int y, x;
+static void generate_topology(player_t *p) {
+	/* Every board gets a fresh stream, the game carries on with it */
+	rng_seed(&p->new_game_rng, rng_new_seed());
+	engine_board(p->new_game_board, p->new_game_planets, &p->new_game_rng);
+}
+
+static void draw_topology(char *r, board_t *b, int planets) {
+	char map[BOARD_SIZE][2 * BOARD_SIZE];
+	int i, y;
 	
+	memset(map, ' ', sizeof(map));
 	for (y = 0; y < BOARD_SIZE; y++) {
-		for (x = 0; x < BOARD_SIZE; x++) {
-			strncat(r, &b->nodes[y][x].name, 1);
-			strcat(r, " ");
+		for (i = 0; i < BOARD_SIZE; i++) {
+			map[y][2 * i] = '.';
 		}
-		strcat(r, "|\r\n");
+	}
+	for (i = 0; i < planets; i++) {
+		map[b->y[i]][2 * b->x[i]] = 'A' + i;
+	}
+	
+	r += strlen(r);
+	for (y = 0; y < BOARD_SIZE; y++) {
+		memcpy(r, map[y], 2 * BOARD_SIZE);
+		r += 2 * BOARD_SIZE;
+		memcpy(r, "|\r\n", 3);
+		r += 3;
+	}
+	*r = '\0';
+}
+
+static void send_game_screen(game_t *g, player_t *p) {
+	char buf[SCREEN_ANSI_SIZE];
+	const char *text;
+	size_t len;
+	
+	if (p->ansi) {
+		player_send(p, buf, screen_ansi(g->screen, p->screen_gen, buf));
+		p->screen_gen = g->screen->gen;
+	} else {
+		text = screen_text(g->screen, &len);
+		player_send(p, text, len);
 	}
 }
 
+/* Players who want the plain screen all get the same copy of it */
 static void draw_game_screen(game_t *g) {
-	int y, x;
-	char r[4096], line_buffer[128];
+	int i;
+	const char *text;
+	size_t len;
+	shared_t *b, *frame = NULL;
+	unsigned char state[BINARY_STATE_SIZE];
 	
-	memset(r, 0, sizeof(r));
+	broadcast_flush(g);    /* whatever happened comes before the screen */
 	
-	for (y = 0; y < BOARD_SIZE; y++) {
-		for (x = 0; x < BOARD_SIZE; x++) {
-			strncat(r, &g->board.nodes[y][x].name, 1);
-			strcat(r, " ");
+	screen_update(g->screen, g);
+	text = screen_text(g->screen, &len);
+	b = shared_new(len);
+	shared_append(b, text, len);
+	
+	if (game_has_binary_players(g)) {
+		len = binary_state(state, g);
+		frame = shared_new(len);
+		shared_append(frame, (char *) state, len);
+	}
+	
+	for (i = 0; i < g->cplayers; i++) {
+		if (!g->player_list[i]) {
+			continue;
 		}
-		strcat(r, "| ");
-		if (!y) {
-			strcat(r, "Planet  Ships  Prod  Attack%  Owner\r\n");
-		} else if (y <= g->planets) {
-			memset(line_buffer, 0, sizeof(line_buffer));
-			if (g->planet_list[y-1]->owner) {
-				sprintf(line_buffer, "%-6c  %-5d  %-4d  %-7d  %s\r\n",
-					                 'A'+y-1,
-					                 g->planet_list[y-1]->ships,
-					                 g->planet_list[y-1]->prod,
-					                 g->planet_list[y-1]->attack,
-					                 g->planet_list[y-1]->owner);
-			} else {
-				sprintf(line_buffer, "%c\r\n", 'A'+y-1);
-			}
-			strcat(r, line_buffer);
+		if (g->player_list[i]->binary) {
+			player_send_shared_frame(g->player_list[i], frame);
+		} else if (g->player_list[i]->ansi) {
+			send_game_screen(g, g->player_list[i]);
 		} else {
-			strcat(r, "\r\n");
+			player_send_shared(g->player_list[i], b);
 		}
 	}
-	for (x = 0; x < BOARD_SIZE; x++) {
-		strcat(r, "--");
-	}
-	if (g->cturn <= g->turns) {
-		sprintf(line_buffer, "+-[Galactic Turtle, Turn #%2d/%2d]-\r\n",
-		                     g->cturn, g->turns);
-	} else {
-		sprintf(line_buffer, "+-[Galactic Turtle, Game Over :o ]-\r\n");
+	shared_release(b);
+	if (frame) {
+		shared_release(frame);
 	}
-	strcat(r, line_buffer);
-	
-	send_to_all_players(g, r);
 }
 
 static void reset_player_list(game_t *g) {
@@ -170,95 +360,153 @@ static void show_menu_to_player(player_t *p) {
 	                  "2. Game list\r\n"
 	                  "3. Join a game\r\n"
 	                  "4. Highscore list\r\n"
-	                  "5. Exit\r\n\r\n"
+	                  "5. Exit\r\n"
+	                  "6. Look up a rank\r\n\r\n"
 	                  "Selection: ");
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 }
 
-static void show_game_list_to_player(player_t *p, game_node_t *game_list) {
-	game_node_t *tmp = game_list;
-	char response[256], mini_buffer[10];
+static void show_game_list_to_player(player_t *p) {
+	game_t *tmp;
+	char *response, mini_buffer[24];
+	size_t len, size = 256;
 	
-	memset(response, 0, sizeof(response));
+	if (!(response = malloc(size))) {
+		exit_with("malloc error", 1);
+	}
 	
 	strcpy(response, "\r\n"
 	                 "Game ID  Players  Planets  Turns  Open\r\n"
 	                 "=======  =======  =======  =====  ====\r\n");
-	write(p->fd, response, strlen(response));
-	
-	while (tmp != NULL) {
-		sprintf(mini_buffer, "%d/%d", tmp->game.cplayers, tmp->game.players);
-		sprintf(response, "%-7d  %-7s  %-7d  %'-5d  %-4s\r\n",
-		                   tmp->game.id,
-		                   mini_buffer,
-		                   tmp->game.planets,
-		                   tmp->game.turns,
-		                   tmp->game.open ? "Yes" : "No");
-		write(p->fd, response, strlen(response));
-		
-		tmp = tmp->next;
-	}
+	len = strlen(response);
+	
+	/* Format the list while holding the lock, write it out afterwards */
+	pthread_mutex_lock(&games_lock);
+	for (tmp = games.listed_head; tmp != NULL; tmp = tmp->listed_next) {
+		if (size - len < 128) {
+			size *= 2;
+			if (!(response = realloc(response, size))) {
+				exit_with("realloc error", 1);
+			}
+		}
+		sprintf(mini_buffer, "%d/%d", tmp->cplayers, tmp->players);
+		len += sprintf(response + len, "%-7d  %-7s  %-7d  %'-5d  %-4s\r\n",
+		                                tmp->id,
+		                                mini_buffer,
+		                                tmp->planets,
+		                                tmp->turns,
+		                                tmp->open ? "Yes" : tmp->restoring ? "Rejoin" : "No");
+	}
+	pthread_mutex_unlock(&games_lock);
+	
+	player_send(p, response, len);
+	free(response);
 }
 
+/* Shows the player's current page of high scores, then asks where to go
+   from there unless that's all there is. */
 static void show_scoreboard_to_player(player_t *p) {
-	char response[256];
+	char response[96];
+	shared_t *b;
+	int npages;
 	
-	memset(response, 0, sizeof(response));
+	b = scoreboard_page(&p->scores_page, &npages);
+	player_send_shared(p, b);
+	shared_release(b);
 	
-	strcpy(response, "\r\n"
-	                 "Player           Best Score  Last Score\r\n"
-	                 "======           ==========  ==========\r\n");
-	write(p->fd, response, strlen(response));
+	if (npages == 1) {
+		p->state = MENU;
+		show_menu_to_player(p);
+		return;
+	}
 	
-	scoreboard_list(p);
+	sprintf(response, "\r\nPage %d/%d - [n]ext, [p]revious or enter for the menu: ",
+	                  p->scores_page + 1, npages);
+	p->state = SCORES_1;
+	player_print(p, response);
 }
 
-static int add_game_to_list(game_node_t **game_list, player_t *p) {
-	game_node_t *tmp = *game_list;
-	int i, x, y, game_id = 1;
+static int add_game_to_list(player_t *p) {
+	game_t *g;
+	int game_id;
 	
-	if (!*game_list) {
-		tmp = *game_list = malloc(sizeof(game_node_t));
-	} else {
-		while (tmp != NULL && tmp->next != NULL) {
-			tmp = tmp->next;
-		}
-		game_id = tmp->game.id + 1;
-		tmp->next = malloc(sizeof(game_node_t));
-		tmp = tmp->next;
-	}
-	
-	tmp->game.players = p->new_game_players;
-	tmp->game.planets = p->new_game_planets;
-	tmp->game.turns = p->new_game_turns;
-	tmp->game.id = game_id;
-	tmp->game.open = 1;
-	tmp->game.cplayers = 0;
-	tmp->game.cturn = 1;
-	memset(&tmp->game.player_list, 0, sizeof(tmp->game.player_list));
-	memset(&tmp->game.planet_list, 0, sizeof(tmp->game.planet_list));
-	memcpy(&tmp->game.board, p->new_game_board, sizeof(board_t));
-	for (y = 0; y < BOARD_SIZE; y++) {
-		for (x = 0; x < BOARD_SIZE; x++) {
-			if (tmp->game.board.nodes[x][y].name != '.') {
-				i = (int) tmp->game.board.nodes[x][y].name - 'A';
-				tmp->game.planet_list[i] = &tmp->game.board.nodes[x][y];
-			}
-		}
+	if (!(g = calloc(1, sizeof(game_t)))) {
+		exit_with("calloc error", 1);
 	}
-	tmp->next = NULL;
+	
+	g->players = p->new_game_players;
+	g->planets = p->new_game_planets;
+	g->turns = p->new_game_turns;
+	g->open = 1;
+	g->cplayers = 0;
+	g->cturn = 1;
+	g->rng = p->new_game_rng;
+	memcpy(&g->board, p->new_game_board, sizeof(board_t));
+	g->screen = screen_new(g);
+	
+	pthread_mutex_lock(&games_lock);
+	game_id = registry_insert(&games, g);
+	g->shard = p->shard;          /* so the lobby clock can start right away */
+	pthread_mutex_unlock(&games_lock);
 	
 	return game_id;
 }
 
-static game_t *find_game_by_id(int game_id, game_node_t *game_list) {
-	game_node_t *tmp = game_list;
+/* Only safe on the game's own shard, anyone else may see it disappear as
+   soon as the lock is released. */
+static game_t *find_game_by_id(int game_id) {
+	game_t *g;
 	
-	while (tmp != NULL && tmp->game.id != game_id) {
-		tmp = tmp->next;
+	pthread_mutex_lock(&games_lock);
+	g = registry_find(&games, game_id);
+	pthread_mutex_unlock(&games_lock);
+	
+	return g;
+}
+
+/* (Re)starts the clock on whatever the game is waiting for, see
+   game_timed_out() */
+static void set_game_deadline(game_t *g, int secs) {
+	if (secs > 0) {
+		wheel_add(&shards[g->shard].wheel, &g->deadline, secs * 1000);
+	} else {
+		wheel_cancel(&shards[g->shard].wheel, &g->deadline);
+	}
+}
+
+/* Pushes back the moment an idle player gets dropped */
+static void set_player_idle(player_t *p) {
+	if (idle_time > 0) {
+		wheel_add(&shards[p->shard].wheel, &p->idle, idle_time * 1000);
 	}
+}
+
+/* Takes a finished game off the game list, it lingers until the players
+   have seen the results. */
+static void unlist_game(game_t *g) {
+	pthread_mutex_lock(&games_lock);
+	registry_unlist(&games, g);
+	pthread_mutex_unlock(&games_lock);
+}
+
+static void remove_game(game_t *g) {
+	int i;
 	
-	return &tmp->game;
+	pthread_mutex_lock(&games_lock);
+	registry_remove(&games, g);
+	pthread_mutex_unlock(&games_lock);
+	
+	wheel_cancel(&shards[g->shard].wheel, &g->deadline);
+	journal_drop(g);
+	replay_close(g);
+	for (i = 0; i < MOVE_SLOTS; i++) {
+		moves_free(&g->moves[i]);
+	}
+	if (g->bcast) {
+		shared_release(g->bcast);
+	}
+	free(g->screen);
+	free(g);
 }
 
 static void add_player_to_game(game_t *g, player_t *p) {
@@ -270,6 +518,14 @@ static void add_player_to_game(game_t *g, player_t *p) {
 			break;
 		}
 	}
+	
+	/* Nobody owns anything before the game starts, so any free id will do */
+	for (p->id = 0; g->alive & (1u << p->id); p->id++);
+	g->alive |= 1u << p->id;
+	strcpy(g->nicknames[p->id], p->nickname);
+	
+	p->screen_gen = 0;    /* nothing of this game on their screen yet */
+	p->batch = 0;
 }
 
 static int nickname_available(game_t *g, char *nickname) {
@@ -283,31 +539,15 @@ static int nickname_available(game_t *g, char *nickname) {
 	return 1;
 }
 
-static int nickname_valid(char *nickname) {
-	char regex[] = "^[A-z0-9 ]+$";
-	static int initialized = 0;
-	static regex_t *regex_comp;
+/* The ids of the players in the game, in player_list order */
+static int game_seats(game_t *g, int *seats) {
+	int i;
 	
-	if (!initialized) {
-		if (!(regex_comp = malloc(sizeof(regex_t)))) {
-			exit_with("malloc error", 1);
-		}
-		if (regcomp(regex_comp, regex, REG_EXTENDED | REG_NOSUB)) {
-			exit_with("regex compilation error", 0);
-		}
-		initialized = 1;
+	for (i = 0; i < g->cplayers; i++) {
+		seats[i] = g->player_list[i]->id;
 	}
 	
-	return regexec(regex_comp, nickname, 0, NULL, 0) ? 0 : 1;
-}
-
-static void assign_planets_to_players(game_t *g) {
-	int i, j;
-	
-	for (i = 0; i < g->players; i++) {
-		while (g->planet_list[(j = random_int() % g->planets)]->owner);
-		g->planet_list[j]->owner = g->player_list[i]->nickname;
-	}
+	return g->cplayers;
 }
 
 static void check_if_game_is_full(game_t *g) {
@@ -320,7 +560,7 @@ static void prompt_player_for_move(player_t *p) {
 	char buffer[32];
 	
 	sprintf(buffer, "%s> ", p->nickname);
-	write(p->fd, buffer, strlen(buffer));
+	player_print(p, buffer);
 }
 
 static void prompt_players_for_move(game_t *g) {
@@ -332,83 +572,63 @@ static void prompt_players_for_move(game_t *g) {
 }
 
 static void check_if_game_is_ready_to_start(game_t *g) {
-	int i;
+	int i, seats[MAX_PLAYERS];
 	
 	if (g->rplayers == g->players) {
-		assign_planets_to_players(g);
+		g->started = 1;
+		set_game_deadline(g, turn_time);
+		game_seats(g, seats);
+		replay_open(g, seats, combat_mode);
+		engine_start(g, seats);
 		draw_game_screen(g);
 		prompt_players_for_move(g);
 		for (i = 0; i < g->cplayers; i++) {
 			g->player_list[i]->state = IN_GAME_2;
 		}
 		g->rplayers = 0;
+		journal_save(g);
 	}
 }
 
-static int player_exists_in_game(game_t *g, char *nickname) {
-	int i;
+static player_t *decide_winner(game_t *g, int *scores) {
+	int i, s, m = 0, winner = 0;
 	
 	for (i = 0; i < g->cplayers; i++) {
-		if (!strcmp(g->player_list[i]->nickname, nickname)) {
-			return 1;
-		}
-	}
-	
-	return 0;
-}
-
-static void cleanup_orphaned_planets(game_t *g, int show_message) {
-	int i, j;
-	char buffer[128];
-	
-	for (i = 0; i < g->planets; i++) {
-		if (g->planet_list[i]->owner && !player_exists_in_game(g, g->planet_list[i]->owner)) {
-			if (show_message) {
-				sprintf(buffer, "%s has disconnected.\r\n", g->planet_list[i]->owner);
-				send_to_all_players(g, buffer);
-			}
-			for (j = i+1; j < g->planets; j++) {
-				if (g->planet_list[j]->owner == g->planet_list[i]->owner) {
-					g->planet_list[j]->owner = NULL;
-				}
-			}
-			free(g->planet_list[i]->owner);
-			g->planet_list[i]->owner = NULL;
-		}
-	}
-}
-
-static int calc_score(game_t *g, char *nickname) {
-	int i, s;
-	
-	for (i = s = 0; i < g->planets; i++) {
-		if (g->planet_list[i]->owner == nickname) {
-			s += g->planet_list[i]->ships * g->planet_list[i]->attack;
+		if ((s = scores[g->player_list[i]->id + 1]) > m) {
+			m = s;
+			winner = i;
 		}
 	}
 	
-	return s;
+	return g->player_list[winner];
 }
 
-static player_t *decide_winner(game_t *g) {
-	int i, s, m = 0, winner = 0;
+static void draw_scores(char *r, game_t *g, int *scores) {
+	int i;
 	
+	r += sprintf(r, "Player               Score\r\n"
+	                "======               =====\r\n");
 	for (i = 0; i < g->cplayers; i++) {
-		if ((s = calc_score(g, g->player_list[i]->nickname)) > m) {
-			m = s;
-			winner = i;
-		}
+		r += sprintf(r, "%-20s %d\r\n", g->player_list[i]->nickname,
+		             scores[g->player_list[i]->id + 1]);
 	}
-	
-	return g->player_list[winner];
 }
 
 static void end_game(game_t *g) {
-	int i, s;
+	int i, scores[MAX_PLAYERS + 1];
 	player_t *winner;
 	char buffer[4096], line_buffer[128];
+	unsigned char frame[BINARY_END_SIZE];
+	size_t len;
 	
-	cleanup_orphaned_planets(g, 0);
+	engine_orphans(g, NULL, NULL);
+	engine_scores(g, scores);
+	replay_end(g, scores);
+	
+	g->over = 1;
+	unlist_game(g);
+	wheel_cancel(&shards[g->shard].wheel, &g->deadline);
+	journal_drop(g);
 	
 	/* If all players disconnected during a round there's nothing to do */
 	if (!g->cplayers) {
@@ -419,207 +639,115 @@ static void end_game(game_t *g) {
 		g->player_list[i]->state = END_GAME_1;
 	}
 	
-	strcpy(buffer, "Player               Score\r\n");
-	strcat(buffer, "======               =====\r\n");
 	for (i = 0; i < g->cplayers; i++) {
-		s = calc_score(g, g->player_list[i]->nickname);
-		scoreboard_add(g->player_list[i]->nickname, s);
-		sprintf(line_buffer, "%-20s %d\r\n", g->player_list[i]->nickname, s);
-		strcat(buffer, line_buffer);
+		scoreboard_add(g->player_list[i]->nickname, g->id, scores[g->player_list[i]->id + 1]);
 	}
+	
+	draw_scores(buffer, g, scores);
 	strcat(buffer, "\r\n");
 	
-	winner = decide_winner(g);
+	winner = decide_winner(g, scores);
 	sprintf(line_buffer, "%s wins the game. Press enter to go back to the menu.",
 	                winner->nickname);
 	strcat(buffer, line_buffer);
 	
 	send_to_all_players(g, buffer);
+	
+	len = binary_end(frame, g, scores, winner);
+	for (i = 0; i < g->cplayers; i++) {
+		player_send_frame(g->player_list[i], frame, len);
+	}
 }
 
-/* Returns 1 with probability p% */
-static int do_it_faggot(int p) {
-	if (random_int() % 100 < p) {
-		return 1;
-	}
-	return 0;
+/* The scores as they would be if the game ended now */
+static void show_standings_to_player(game_t *g, player_t *p) {
+	int scores[MAX_PLAYERS + 1];
+	char buffer[1024];
+	
+	engine_scores(g, scores);
+	draw_scores(buffer, g, scores);
+	player_print(p, buffer);
 }
 
-static void advance_turn(game_t *g) {
-	int i, r;
-	double defense;
-	move_t *m = g->moves_list[g->cturn - 1];
+/* Tells everybody what engine_turn() just did */
+static void report_turn_event(const turn_event_t *e, void *data) {
+	static const char *prod_down[] = {
+		"Due to lazy workers, ship productivity of planet %c decreases %d%%.\r\n",
+		"An accident takes place and ship productivity of planet %c decreases %d%%.\r\n",
+		"Workers go on strike. Ship productivity of planet %c decreases %d%%.\r\n"
+	};
+	static const char *prod_up[] = {
+		"Thanks to better economy, ship productivity of planet %c increases %d%%.\r\n",
+		"New equipment arrives. Ship productivity of planet %c increases %d%%.\r\n",
+		"More people are hired and ship productivity of planet %c increases %d%%.\r\n"
+	};
+	static const char *attack_down[] = {
+		"Due to poor quality ammunition, attack ratio of planet %c decreases %d%%.\r\n",
+		"Ammunition delivery is late, attack ratio of planet %c decreases %d%%.\r\n",
+		"Weapon systems maintenance, attack ratio of planet %c decreases %d%%.\r\n"
+	};
+	static const char *attack_up[] = {
+		"Thanks to new technology ships, attack ratio of planet %c increases %d%%.\r\n",
+		"An ammunition delivery raises the attack ratio of planet %c by %d%%.\r\n",
+		"New weapon system developed, attack ratio of planet %c increases %d%%.\r\n"
+	};
+	game_t *g = (game_t *) data;
 	char buffer[128];
-	int diff;
-	
-	send_to_all_players(g, "\r\n");
-	
-	cleanup_orphaned_planets(g, 1);
-	
-	/* Random events */	
-	for (i = 0; i < g->planets; i++) {
-		if (g->planet_list[i]->owner && do_it_faggot(10)) {
-			r = (random_int() % 50) + 1;
-			diff = ceil((g->planet_list[i]->prod * r) / 100);
-			if (diff) {
-				if (do_it_faggot(50)) {
-					g->planet_list[i]->prod -= diff;
-					switch (random_int() % 3) {
-						case 0:
-							sprintf(buffer, "Due to lazy workers, ship productivity of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 1:
-							sprintf(buffer, "An accident takes place and ship productivity of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 2:
-							sprintf(buffer, "Workers go on strike. Ship productivity of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						default:
-							break;
-					}
-					send_to_all_players(g, buffer);
-				} else {
-					g->planet_list[i]->prod += diff;
-					switch (random_int() % 3) {
-						case 0:
-							sprintf(buffer, "Thanks to better economy, ship productivity of"
-								            " planet %c increases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 1:
-							sprintf(buffer, "New equipment arrives. Ship productivity of"
-								            " planet %c increases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 2:
-							sprintf(buffer, "More people are hired and ship productivity of"
-								            " planet %c increases %d%%.\r\n", 'A'+i, r);
-							break;
-						default:
-							break;
-					}
-					send_to_all_players(g, buffer);
-				}
-			}
-		}
-		
-		if (g->planet_list[i]->owner && do_it_faggot(10)) {
-			r = (random_int() % 50) + 1;
-			diff = ceil((g->planet_list[i]->attack * r) / 100);
-			if (diff) {
-				if (do_it_faggot(50)) {
-					g->planet_list[i]->attack -= diff;
-					switch (random_int() % 3) {
-						case 0:
-							sprintf(buffer, "Due to poor quality ammunition, attack ratio of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 1:
-							sprintf(buffer, "Ammunition delivery is late, attack ratio of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 2:
-							sprintf(buffer, "Weapon systems maintenance, attack ratio of"
-								            " planet %c decreases %d%%.\r\n", 'A'+i, r);
-							break;
-						default:
-							break;
-					}
-					send_to_all_players(g, buffer);
-				} else {
-					g->planet_list[i]->attack += diff;
-					switch (random_int() % 3) {
-						case 0:
-							sprintf(buffer, "Thanks to new technology ships, attack ratio of"
-								            " planet %c increases %d%%.\r\n", 'A'+i, r);
-							break;
-						case 1:
-							sprintf(buffer, "An ammunition delivery raises the attack ratio of"
-								            " planet %c by %d%%.\r\n", 'A'+i, r);
-							break;
-						case 2:
-							sprintf(buffer, "New weapon system developed, attack ratio of"
-								            " planet %c increases %d%%.\r\n", 'A'+i, r);
-							break;
-						default:
-							break;
-					}
-					send_to_all_players(g, buffer);
-				}
-			}
-		}
-		
-		if (g->planet_list[i]->owner && do_it_faggot(1)) {
-			do {
-				r = random_int() % g->cplayers;
-			} while (g->planet_list[i]->owner == g->player_list[r]->nickname);
-			g->planet_list[i]->owner = g->player_list[r]->nickname;
-			sprintf(buffer, "The people of planet %c decide to join %s.\r\n", 'A'+i, g->player_list[r]->nickname);
-			send_to_all_players(g, buffer);
-		}
-		
-		/* Produce new ships */
-		if (g->planet_list[i]->owner) {
-			g->planet_list[i]->ships += g->planet_list[i]->prod;
-		}
-	}
+	int planet = 'A' + e->planet;
 	
-	g->cturn++;
-	
-	while (m) {
-		if (m->owner->in_game != g->id) {
-			m = m->next;
-			continue;
-		}
-		if (m->target->owner && m->owner->nickname == m->target->owner) {
-			m->target->ships += m->ships;
-			sprintf(buffer, "Reinforcements (%d ships) arrive at planet %c.\r\n", m->ships, m->target->name);
-			send_to_all_players(g, buffer);
-		} else {
-			defense = m->target->attack + (random_int() % 16);
-			while (m->ships && m->target->ships) {
-				if ((random_int() % 101) > m->attack) {
-					m->ships--;
-				}
-				if (!m->ships) {
-					break;
-				}
-				if ((random_int() % 101) > defense) {
-					m->target->ships--;
-				}
+	switch (e->kind) {
+		case TURN_GONE:
+			sprintf(buffer, "%s has disconnected.\r\n", g->nicknames[e->player]);
+			break;
+		case TURN_PROD:
+			sprintf(buffer, e->value < 0 ? prod_down[e->variant] : prod_up[e->variant],
+			        planet, abs(e->value));
+			break;
+		case TURN_ATTACK:
+			sprintf(buffer, e->value < 0 ? attack_down[e->variant] : attack_up[e->variant],
+			        planet, abs(e->value));
+			break;
+		case TURN_DEFECT:
+			sprintf(buffer, "The people of planet %c decide to join %s.\r\n", planet,
+			        g->nicknames[e->player]);
+			break;
+		case TURN_REINFORCE:
+			sprintf(buffer, "Reinforcements (%d ships) arrive at planet %c.\r\n",
+			        e->value, planet);
+			break;
+		case TURN_CONQUER:
+			if (e->owner != NOBODY) {
+				sprintf(buffer, "%s attacks planet %c and wins with %d ships remaining.\r\n",
+				        g->nicknames[e->player], planet, e->value);
+			} else {
+				sprintf(buffer, "%s conquers planet %c with %d ships remaining.\r\n",
+				        g->nicknames[e->player], planet, e->value);
 			}
-			
-			if (m->target->owner) {           /* this is not a neutral planet */
-				if (m->ships) {
-					sprintf(buffer, "%s attacks planet %c and wins with %d"
-						            " ships remaining.\r\n",
-						            m->owner->nickname, m->target->name, m->ships);
-					m->target->owner = m->owner->nickname;
-					m->target->ships = m->ships;
-				} else {
-					sprintf(buffer, "%s attacks planet %c but loses. %s is"
-						            " left with %d ships.\r\n", 
-						            m->owner->nickname, m->target->name,
-						            m->target->owner, m->target->ships);
-				}
-			} else {                       /* this is a neutral planet */
-				if (m->ships) {
-					sprintf(buffer, "%s conquers planet %c with %d"
-						            " ships remaining.\r\n",
-						            m->owner->nickname, m->target->name, m->ships);
-					m->target->owner = m->owner->nickname;
-					m->target->ships = m->ships;
-					m->target->prod = 10;
-				} else {
-					sprintf(buffer, "%s tries to conquer planet %c but fails.\r\n", 
-						            m->owner->nickname, m->target->name);
-				}
+			break;
+		case TURN_REPELLED:
+			if (e->owner != NOBODY) {
+				sprintf(buffer, "%s attacks planet %c but loses. %s is left with %d ships.\r\n",
+				        g->nicknames[e->player], planet, g->nicknames[e->owner], e->value);
+			} else {
+				sprintf(buffer, "%s tries to conquer planet %c but fails.\r\n",
+				        g->nicknames[e->player], planet);
 			}
-			send_to_all_players(g, buffer);
-		}
-		m = m->next;
+			break;
+		default:
+			return;
 	}
+	broadcast(g, buffer);
+	replay_event(g, e);
+}
+
+static void advance_turn(game_t *g) {
+	int i, seats[MAX_PLAYERS];
+	
+	broadcast(g, "\r\n");
+	game_seats(g, seats);
+	replay_turn(g, seats, g->cplayers);
+	engine_turn(g, seats, g->cplayers, combat_mode, report_turn_event, g);
+	replay_flush(g);
 	
 	for (i = 0; i < g->cplayers; i++) {
 		g->player_list[i]->state = IN_GAME_2;
@@ -630,112 +758,168 @@ static void advance_turn(game_t *g) {
 	if (g->cturn > g->turns || g->cplayers < 2) {
 		end_game(g);
 	} else {
+		set_game_deadline(g, turn_time);
 		prompt_players_for_move(g);
+		journal_save(g);
 	}
 }
 
-static void add_move_to_list(move_t **move_list, player_t *owner, board_node_t *target, int ships, int attack) {
-	move_t *tmp = *move_list;
+/* Ends the turn for everybody who hasn't already */
+static void turn_timed_out(game_t *g) {
+	int i;
+	player_t *p;
 	
-	if (!*move_list) {
-		tmp = *move_list = malloc(sizeof(move_t));
-	} else {
-		while (tmp != NULL && tmp->next != NULL) {
-			if (tmp->owner == owner && tmp->attack == attack && tmp->target == target) {
-				tmp->ships += ships;
-				return;
-			}
-			tmp = tmp->next;
-		}
-		if (tmp->owner == owner && tmp->attack == attack && tmp->target == target) {
-			tmp->ships += ships;
-			return;
+	for (i = 0; i < g->cplayers; i++) {
+		p = g->player_list[i];
+		if (p->state == IN_GAME_2) {
+			player_print(p, "\r\nTime's up!\r\n");
+			p->batch = 0;
+			p->state = IN_GAME_3;
+			g->rplayers++;
 		}
-		tmp->next = malloc(sizeof(move_t));
-		tmp = tmp->next;
 	}
-	
-	tmp->owner = owner;
-	tmp->target = target;
-	tmp->ships = ships;
-	tmp->attack = attack;
-	tmp->next = NULL;
+	advance_turn(g);
 }
 
-static int do_move_parse(char *line, int *from, int *to, int *n) {
-	char regex[] = "^([A-z])[[:space:]]+([A-z])[[:space:]]+([1-9][0-9]*)$";
-	static int initialized = 0;
-	static regex_t *regex_comp;
-	static regmatch_t *reg_matches;
+/* The game didn't fill up in time, whoever is waiting goes back to the
+   menu and the game is gone. */
+static void lobby_timed_out(game_t *g) {
+	int i, waiting = 0;
+	player_t *p;
 	
-	if (!initialized) {
-		if (!(regex_comp = malloc(sizeof(regex_t)))) {
-			exit_with("malloc error", 1);
-		}
-		if (!(reg_matches = malloc(sizeof(regmatch_t) * 4))) {
-			exit_with("malloc error", 1);
-		}
-		if (regcomp(regex_comp, regex, REG_EXTENDED)) {
-			exit_with("regex compilation error", 0);
-		}
-		initialized = 1;
+	for (i = 0; i < g->players; i++) {
+		waiting += g->player_list[i] != NULL;
+	}
+	if (waiting < g->cplayers) {
+		set_game_deadline(g, LOBBY_GRACE);    /* someone's typing a nickname */
+		return;
 	}
 	
-	if(!regexec(regex_comp, line, 4, reg_matches, 0)) {
-		line[reg_matches[1].rm_eo] = '\0';
-		*from = toupper(line[reg_matches[1].rm_so]) - 'A';
-		
-		line[reg_matches[2].rm_eo] = '\0';
-		*to = toupper(line[reg_matches[2].rm_so]) - 'A';
-		
-		line[reg_matches[3].rm_eo] = '\0';
-		*n = atoi(&line[reg_matches[3].rm_so]);
-		
-		return 1;
-	} else {
-		return 0;
+	for (i = 0; i < waiting; i++) {
+		p = g->player_list[i];
+		player_print(p, "\r\nNot enough players showed up, the game is off.\r\n");
+		p->in_game = 0;
+		p->state = MENU;
+		show_menu_to_player(p);
+		binary_reply(p, 0, BINARY_FAILED, g->id);
 	}
+	
+	pthread_mutex_lock(&games_lock);
+	g->cplayers = 0;
+	pthread_mutex_unlock(&games_lock);
+	remove_game(g);
 }
 
-static int do_move(player_t *p, char *cmd, game_t *g) {
-	int from, to, n, diffx, diffy, arrival_turn;
+/* Carries on with a restored game. Seats nobody came back for are given
+   up on, their planets go at the next turn. */
+static void resume_game(game_t *g) {
+	int i;
 	
-	if (!strlen(cmd)) {
-		return -1;                      /* Empty command .-. */
-	}
+	g->restoring = 0;
+	g->alive &= ~g->vacant;
+	g->vacant = 0;
 	
-	if (!do_move_parse(cmd, &from, &to, &n)) {
-		return -2;                      /* Invalid command */
+	if (!g->cplayers) {
+		remove_game(g);
+		return;
 	}
 	
-	if (from < 0 || from > g->planets - 1) {
-		return 1;                       /* Invalid source planet */
-	} else if (g->planet_list[from]->owner != p->nickname) {
-		return 2;                       /* Player doesn't own the planet */
+	for (i = 0; i < g->cplayers; i++) {
+		g->player_list[i]->state = IN_GAME_2;
 	}
+	g->rplayers = 0;
+	journal_save(g);
 	
-	if (to < 0 || to > g->planets - 1 || to == from) {
-		return 3;                       /* Invalid target planet */
+	draw_game_screen(g);
+	if (g->cplayers < 2) {
+		end_game(g);
+	} else {
+		set_game_deadline(g, turn_time);
+		prompt_players_for_move(g);
 	}
+}
+
+/* Whether every seat is taken again, by nobody halfway through picking it */
+static void resume_game_if_ready(game_t *g) {
+	int i, seated = 0;
 	
-	if (n <= 0 || n > g->planet_list[from]->ships) {
-		return 4;                       /* Invalid number of ships */
+	for (i = 0; i < g->players; i++) {
+		seated += g->player_list[i] != NULL;
+	}
+	if (!g->vacant && seated == g->cplayers) {
+		resume_game(g);
 	}
+}
+
+/* Not everybody came back to a restored game in time */
+static void restore_timed_out(game_t *g) {
+	int i, seated = 0;
 	
-	diffx = abs(g->planet_list[to]->x - g->planet_list[from]->x);
-	diffy = abs(g->planet_list[to]->y - g->planet_list[from]->y);
-	arrival_turn = floor(sqrt(diffx*diffx + diffy*diffy)) + g->cturn;
-	g->planet_list[from]->ships -= n;
-	if (arrival_turn <= MAX_TURNS) {
-		add_move_to_list(&g->moves_list[arrival_turn - 1], p, g->planet_list[to], n, g->planet_list[from]->attack);
+	for (i = 0; i < g->players; i++) {
+		seated += g->player_list[i] != NULL;
 	}
+	if (seated < g->cplayers) {
+		set_game_deadline(g, LOBBY_GRACE);    /* someone's typing a nickname */
+		return;
+	}
+	resume_game(g);
+}
+
+static void game_timed_out(void *data) {
+	game_t *g = (game_t *) data;
+	
+	if (g->restoring) {
+		restore_timed_out(g);
+	} else if (g->started) {
+		turn_timed_out(g);
+	} else {
+		lobby_timed_out(g);
+	}
+}
+
+/* Registers the board the player settled on as a new game */
+static int create_game(player_t *p) {
+	int game_id = add_game_to_list(p);
+	game_t *g = find_game_by_id(game_id);
+	
+	timeout_init(&g->deadline, game_timed_out, g);
+	set_game_deadline(g, lobby_time);
+	
+	return game_id;
+}
+
+static int do_move(player_t *p, order_t *o, game_t *g) {
+	int n;
+	
+	if ((n = engine_order(g, p->id, o)) < 0) {
+		return -n;                      /* see engine_order() */
+	}
+	replay_order(g, p->id, o->from, o->to, n);
 	
 	return 0;
 }
 
-static void player_disconnected(player_t *p, game_node_t *game_list) {
+/* Carries out the orders on a line one by one, stopping at the first one
+   that can't be. Returns what do_move() does for it. */
+static int do_orders(player_t *p, char *cmd, game_t *g) {
+	const char *line = cmd;
+	order_t o;
+	int r, count;
+	
+	for (count = 0; (r = parse_order(&line, &o)) > 0; count++) {
+		if ((r = do_move(p, &o, g))) {
+			return r;
+		}
+	}
+	
+	if (r < 0) {
+		return -2;                      /* Invalid command */
+	}
+	return count ? 0 : -1;              /* Empty command .-. */
+}
+
+static void player_disconnected(player_t *p) {
 	int i = -1;
-	char *nickname_copy = NULL;
 	game_t *tmp;
 	
 	if (p->new_game_board) {
@@ -744,42 +928,61 @@ static void player_disconnected(player_t *p, game_node_t *game_list) {
 	}
 	
 	if (p->in_game < 0) {
-		tmp = find_game_by_id(-p->in_game, game_list);
+		tmp = find_game_by_id(-p->in_game);
+		pthread_mutex_lock(&games_lock);
 		tmp->cplayers--;
-		tmp->open = 1;
+		if (!tmp->started) {
+			tmp->open = 1;
+		}
+		pthread_mutex_unlock(&games_lock);
+		if (tmp->restoring) {
+			resume_game_if_ready(tmp);
+		}
 	}
 	
 	if (p->in_game > 0) {
-		tmp = find_game_by_id(p->in_game, game_list);
+		tmp = find_game_by_id(p->in_game);
 		p->in_game = 0;
 		
 		/* Reset player list */
 		while (tmp->player_list[++i] != p);
 		
 		tmp->player_list[i] = NULL;
+		if (tmp->restoring) {
+			tmp->vacant |= 1u << p->id;     /* the seat waits for them again */
+			pthread_mutex_lock(&games_lock);
+			tmp->cplayers--;
+			pthread_mutex_unlock(&games_lock);
+			reset_player_list(tmp);
+			return;
+		}
+		tmp->alive &= ~(1u << p->id);   /* planets go at the next turn */
+		pthread_mutex_lock(&games_lock);
 		tmp->cplayers--;
+		if (!tmp->started) {
+			tmp->open = 1;              /* there's room in the lobby again */
+		}
+		pthread_mutex_unlock(&games_lock);
 		if (p->state != IN_GAME_2) {
 			tmp->rplayers--;
 		}
 		reset_player_list(tmp);
 		
-		/* Duplicate player's nickname and set it as planets' owner */
-		for (i = 0; i < tmp->planets; i++) {
-			if (tmp->planet_list[i]->owner == p->nickname) {
-				if (!nickname_copy) {
-					nickname_copy = strdup(p->nickname);
-				}
-				tmp->planet_list[i]->owner = nickname_copy;
-			}
+		if (tmp->started && !tmp->cplayers) {
+			remove_game(tmp);           /* everybody's gone */
+			return;
+		}
+		if (!tmp->started || tmp->over) {
+			return;
 		}
 		
-		if (!tmp->open && tmp->rplayers == tmp->cplayers) {
+		if (tmp->rplayers == tmp->cplayers) {
 			advance_turn(tmp);
 		}
 	}
 }
 
-static int player_menu(player_t *p, char *cmd, game_node_t *game_list) {
+static int player_menu(player_t *p, char *cmd) {
 	char response[64];
 	int selection = atoi(cmd);
 	
@@ -789,25 +992,28 @@ static int player_menu(player_t *p, char *cmd, game_node_t *game_list) {
 		sprintf(response, "Number of players [2-%d]: ", MAX_PLAYERS);
 		p->state = NEW_GAME_1;
 	} else if (selection == 2) {
-		show_game_list_to_player(p, game_list);
+		show_game_list_to_player(p);
 		show_menu_to_player(p);
 	} else if (selection == 3) {
 		strcpy(response, "Enter game id: ");
 		p->state = JOIN_GAME_1;
 	} else if (selection == 4) {
+		p->scores_page = 0;
 		show_scoreboard_to_player(p);
-		show_menu_to_player(p);
 	} else if (selection == 5) {
 		strcpy(response, "Bye!\r\n");
+	} else if (selection == 6) {
+		sprintf(response, "Nickname [max %d chars]: ", MAX_NICK_LEN);
+		p->state = RANK_1;
 	} else {
 		strcpy(response, "Invalid selection, try again: ");
 	}
 	
 	if (strlen(response)) {
-		write(p->fd, response, strlen(response));
+		player_print(p, response);
 	}
 	
-	return (1 <= selection && selection <= 5) ? selection : -1;
+	return (1 <= selection && selection <= 6) ? selection : -1;
 }
 
 static void player_new_game_1(player_t *p, char *cmd) {
@@ -824,7 +1030,7 @@ static void player_new_game_1(player_t *p, char *cmd) {
 		strcpy(response, "Invalid selection, try again: ");
 	}
 	
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 }
 
 static void player_new_game_2(player_t *p, char *cmd) {
@@ -843,7 +1049,7 @@ static void player_new_game_2(player_t *p, char *cmd) {
 		strcpy(response, "Invalid selection, try again: ");
 	}
 	
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 }
 
 static void player_new_game_3(player_t *p, char *cmd) {
@@ -853,7 +1059,7 @@ static void player_new_game_3(player_t *p, char *cmd) {
 	memset(response, 0, sizeof(response));
 	
 	if (1 <= selection && selection <= MAX_TURNS) {
-		draw_topology(response, p->new_game_board);
+		draw_topology(response, p->new_game_board, p->new_game_planets);
 		strcat(response, "\r\nLike it? [y/N]? ");
 		p->new_game_turns = selection;
 		p->state = NEW_GAME_4;
@@ -861,10 +1067,10 @@ static void player_new_game_3(player_t *p, char *cmd) {
 		strcpy(response, "Invalid selection, try again: ");
 	}
 	
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 }
 
-static void player_new_game_4(player_t *p, char *cmd, game_node_t **game_list) {
+static void player_new_game_4(player_t *p, char *cmd) {
 	char response[4096];
 	int selection = tolower(cmd[0]);
 	int game_id;
@@ -872,7 +1078,7 @@ static void player_new_game_4(player_t *p, char *cmd, game_node_t **game_list) {
 	memset(response, 0, sizeof(response));
 	
 	if (selection == 'y') {
-		game_id = add_game_to_list(game_list, p);
+		game_id = create_game(p);
 		sprintf(response, "Game created! ID: %d \r\n", game_id);
 		free(p->new_game_board);
 		p->new_game_board = NULL;
@@ -880,14 +1086,14 @@ static void player_new_game_4(player_t *p, char *cmd, game_node_t **game_list) {
 	} else if (selection == 'n' || !strlen(cmd)) {
 		strcpy(response, "OK, here's another one:\r\n");
 		generate_topology(p);
-		draw_topology(response, p->new_game_board);
+		draw_topology(response, p->new_game_board, p->new_game_planets);
 		strcat(response, "\r\nLike it? [y/N]? ");
 	} else {
 		strcpy(response, "Invalid selection, try again: ");
 	}
 	
 	if (strlen(response)) {
-		write(p->fd, response, strlen(response));
+		player_print(p, response);
 	}
 	
 	if (p->state == MENU) {
@@ -895,16 +1101,36 @@ static void player_new_game_4(player_t *p, char *cmd, game_node_t **game_list) {
 	}
 }
 
-static void player_join_game_1(player_t *p, char *cmd, game_node_t *game_list) {
+/* Moves the player over to the shard owning game g. The player must not be
+   touched by the current shard afterwards. */
+static void hand_player_over(player_t *p, int game_id, int shard) {
+	event_del(shards[p->shard].loop, p->fd);
+	wheel_cancel(&shards[p->shard].wheel, &p->idle);
+	unmark_player_dirty(p);
+	p->want_write = 0;
+	p->handoff_game = game_id;
+	shard_post(&shards[shard], p);
+}
+
+/* Returns 0 if the player was handed over to another shard. */
+static int player_join_game_1(player_t *p, int selection) {
 	char response[64];
-	int selection = atoi(cmd);
+	int i;
 	game_t *tmp;
 	
 	memset(response, 0, sizeof(response));
 	
-	tmp = find_game_by_id(selection, game_list);
+	pthread_mutex_lock(&games_lock);
+	tmp = registry_find(&games, selection);
+	
+	if (tmp && tmp->shard != p->shard) {
+		i = tmp->shard;
+		pthread_mutex_unlock(&games_lock);
+		hand_player_over(p, selection, i);
+		return 0;
+	}
 	
-	if (tmp && tmp->open) {
+	if (tmp && (tmp->open || tmp->vacant)) {
 		sprintf(response, "Enter a nickname [%d chars max]: ", MAX_NICK_LEN);
 		p->in_game = -selection;
 		tmp->cplayers++;
@@ -917,29 +1143,72 @@ static void player_join_game_1(player_t *p, char *cmd, game_node_t *game_list) {
 		strcpy(response, "\r\nNonexistent game!\r\n");
 		p->state = MENU;
 	}
+	pthread_mutex_unlock(&games_lock);
 	
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 	
 	if (p->state == MENU) {
 		show_menu_to_player(p);
 	}
+	
+	return 1;
 }
 
-static void player_join_game_2(player_t *p, char *cmd, game_node_t *game_list) {
+/* Gives a restored game's seat back to whoever had it, going by nickname.
+   Anybody else goes back to the menu. */
+static void rejoin_game(game_t *g, player_t *p) {
+	int i, id;
+	
+	for (id = 0; id < g->players; id++) {
+		if ((g->vacant & (1u << id)) && !strcasecmp(g->nicknames[id], p->nickname)) {
+			break;
+		}
+	}
+	
+	if (id == g->players) {
+		player_print(p, "\r\nNobody by that name is missing from this game!\r\n");
+		pthread_mutex_lock(&games_lock);
+		g->cplayers--;
+		pthread_mutex_unlock(&games_lock);
+		p->in_game = 0;
+		p->state = MENU;
+		show_menu_to_player(p);
+		resume_game_if_ready(g);    /* may have been waiting on them */
+		return;
+	}
+	
+	for (i = 0; g->player_list[i]; i++);
+	g->player_list[i] = p;
+	g->vacant &= ~(1u << id);
+	p->id = id;
+	strcpy(p->nickname, g->nicknames[id]);
+	p->screen_gen = 0;
+	p->batch = 0;
+	p->in_game = g->id;
+	p->state = IN_GAME_1;
+	player_print(p, "Welcome back! Waiting for the other players to return..\r\n");
+	
+	resume_game_if_ready(g);
+}
+
+static void player_join_game_2(player_t *p, char *cmd) {
 	char response[128];
 	game_t *tmp;
 	
 	memset(response, 0, sizeof(response));
 	memset(p->nickname, 0, sizeof(p->nickname));
 	
-	tmp = find_game_by_id(-p->in_game, game_list);
+	tmp = find_game_by_id(-p->in_game);
 	
 	strncpy(p->nickname, cmd, MAX_NICK_LEN);
 	if (!strlen(p->nickname)) {
 		strcpy(response, "Your nickname cannot be empty, try again: ");
+	} else if (tmp->restoring) {
+		rejoin_game(tmp, p);
+		return;
 	} else if (!nickname_available(tmp, p->nickname)) {
 		strcpy(response, "The selected nickname is taken, try another one: ");
-	} else if (!nickname_valid(p->nickname)) {
+	} else if (!parse_nickname(p->nickname)) {
 		strcpy(response, "Your nickname may only consist of letters (A-Z, a-z),"
 		                 " numbers (0-9) and spaces.\r\n"
 		                 "Invalid nickname, try again: ");
@@ -951,90 +1220,855 @@ static void player_join_game_2(player_t *p, char *cmd, game_node_t *game_list) {
 		p->state = IN_GAME_1;
 	}
 	
-	write(p->fd, response, strlen(response));
+	player_print(p, response);
 	
 	check_if_game_is_ready_to_start(tmp);
 }
 
-static void player_in_game_2(player_t *p, char *cmd, game_node_t *game_list) {
-	char response[64];
+static const char *order_error(int r) {
+	switch (r) {
+		case -1:
+			return "To end your turn enter 'pass'.\r\n";
+		case -2:
+			return "You're doing it wrong.\r\n";
+		case 1:
+			return "Wrong source planet buddy.\r\n";
+		case 2:
+			return "You don't own that planet.\r\n";
+		case 3:
+			return "You can't attack that planet.\r\n";
+		case 4:
+			return "You can has ships, not.\r\n";
+		default:
+			return NULL;
+	}
+}
+
+static void player_pass(player_t *p, game_t *g) {
+	if (++g->rplayers == g->cplayers) {
+		advance_turn(g);
+	} else {
+		player_print(p, "Please wait for other players to enter their commands..\r\n");
+		p->state = IN_GAME_3;
+	}
+}
+
+/* Bulk orders: after "orders", every line is taken as orders without a
+   reply until "end" or "pass" closes the batch. Then the player gets a
+   single acknowledgement listing what was rejected. */
+static void player_batch(player_t *p, char *cmd, game_t *g) {
+	const char *line = cmd;
+	char response[128 + BATCH_ERRORS * 64], *r = response;
+	order_t o;
+	int i, e;
+	
+	if (strcasecmp(cmd, "end") && strcasecmp(cmd, "pass")) {
+		while ((e = parse_order(&line, &o))) {
+			p->batch_orders++;
+			if (e > 0) {
+				e = do_move(p, &o, g);
+			} else {
+				e = -2;
+				if (!(line = strchr(line, ';'))) {
+					line = "";
+				}
+			}
+			if (e && p->batch_failed++ < BATCH_ERRORS) {
+				p->batch_errors[p->batch_failed - 1][0] = p->batch_orders;
+				p->batch_errors[p->batch_failed - 1][1] = e;
+			}
+		}
+		return;
+	}
+	
+	p->batch = 0;
+	r += sprintf(r, "Orders: %d accepted, %d rejected.\r\n",
+	             p->batch_orders - p->batch_failed, p->batch_failed);
+	for (i = 0; i < p->batch_failed && i < BATCH_ERRORS; i++) {
+		r += sprintf(r, "Order %d: %s", p->batch_errors[i][0],
+		             order_error(p->batch_errors[i][1]));
+	}
+	if (p->batch_failed > BATCH_ERRORS) {
+		sprintf(r, "(%d more rejected)\r\n", p->batch_failed - BATCH_ERRORS);
+	}
+	player_print(p, response);
+	
+	if (!strcasecmp(cmd, "pass")) {
+		player_pass(p, g);
+	} else {
+		prompt_player_for_move(p);
+	}
+}
+
+static void player_in_game_2(player_t *p, char *cmd) {
+	const char *response = NULL;
 	game_t *tmp;
 	
-	memset(response, 0, sizeof(response));
+	tmp = find_game_by_id(p->in_game);
 	
-	tmp = find_game_by_id(p->in_game, game_list);
+	if (p->batch) {
+		player_batch(p, cmd, tmp);
+		return;
+	}
 	
-	if (!strcasecmp(cmd, "pass")) {
-		if (++tmp->rplayers == tmp->cplayers) {
-			advance_turn(tmp);
-		} else {
-			strcpy(response, "Please wait for other players to enter their commands..\r\n");
-			p->state = IN_GAME_3;
+	if (!strcasecmp(cmd, "ansi")) {
+		/* Toggle in-place screen updates, starting over with a full one */
+		p->ansi = !p->ansi;
+		p->screen_gen = 0;
+		if (!p->ansi) {
+			player_print(p, "\033[r");
 		}
+		send_game_screen(tmp, p);
+	} else if (!strcasecmp(cmd, "standings")) {
+		show_standings_to_player(tmp, p);
+	} else if (!strcasecmp(cmd, "orders")) {
+		p->batch = 1;
+		p->batch_orders = p->batch_failed = 0;
+		return;                         /* quiet until the batch is over */
+	} else if (!strcasecmp(cmd, "pass")) {
+		player_pass(p, tmp);
+		return;
 	} else {
-		switch (do_move(p, cmd, tmp)) {
-			case -1:
-				strcpy(response, "To end your turn enter 'pass'.\r\n");
+		response = order_error(do_orders(p, cmd, tmp));
+	}
+	
+	if (response) {
+		player_print(p, response);
+	}
+	prompt_player_for_move(p);
+}
+
+static void player_scores_1(player_t *p, char *cmd) {
+	if (*cmd == 'n' || *cmd == 'N') {
+		p->scores_page++;
+	} else if (*cmd == 'p' || *cmd == 'P') {
+		p->scores_page--;
+	} else {
+		p->state = MENU;
+		show_menu_to_player(p);
+		return;
+	}
+	show_scoreboard_to_player(p);
+}
+
+static void player_rank_1(player_t *p, char *cmd) {
+	char response[192];
+	const char *nickname = *cmd ? cmd : p->nickname;    /* their own, if any */
+	rank_t r;
+	
+	if (strlen(nickname) > MAX_NICK_LEN || !parse_nickname(nickname) ||
+	    !scoreboard_rank(nickname, &r)) {
+		strcpy(response, "\r\nNobody by that name has finished a game yet.\r\n");
+	} else {
+		sprintf(response, "\r\n%s is ranked %d of %d (top %.1f%%), with a best score of"
+		                  " %d and %d last time, after %d game%s.\r\n",
+		                  nickname, r.rank, r.players, 100.0 * r.rank / r.players,
+		                  r.best, r.last, r.games, r.games == 1 ? "" : "s");
+	}
+	player_print(p, response);
+	
+	p->state = MENU;
+	show_menu_to_player(p);
+}
+
+static void player_end_game_1(player_t *p) {
+	game_t *tmp;
+	
+	tmp = find_game_by_id(p->in_game);
+	pthread_mutex_lock(&games_lock);
+	tmp->cplayers--;
+	pthread_mutex_unlock(&games_lock);
+	if (!tmp->cplayers) {
+		remove_game(tmp);
+	}
+	p->in_game = 0;
+	if (p->ansi) {
+		player_print(p, "\033[r");    /* give the whole terminal back */
+	}
+	show_menu_to_player(p);
+	p->state = MENU;
+}
+
+/* Players who disconnect go on a free list for the next connection to use,
+   which spares every connect a calloc() of the input buffer and the rest.
+   Shards accept connections on their own, so the list is shared. */
+static pthread_mutex_t players_lock = PTHREAD_MUTEX_INITIALIZER;
+static player_t *free_players = NULL;
+
+static player_t *player_new(int fd, int shard) {
+	player_t *p;
+	
+	pthread_mutex_lock(&players_lock);
+	if ((p = free_players)) {
+		free_players = p->next;
+	}
+	pthread_mutex_unlock(&players_lock);
+	
+	if (p) {
+		memset(p, 0, sizeof(player_t));
+	} else if (!(p = calloc(1, sizeof(player_t)))) {
+		exit_with("malloc error", 1);
+	}
+	
+	outq_init(&p->outq);
+	p->fd = fd;
+	p->shard = shard;
+	p->in_game = 0;
+	p->new_game_board = NULL;
+	p->state = MENU;
+	
+	return p;
+}
+
+static void player_release(player_t *p) {
+	p->fd = -1;
+	outq_free(&p->outq);
+	pthread_mutex_lock(&players_lock);
+	p->next = free_players;
+	free_players = p;
+	pthread_mutex_unlock(&players_lock);
+}
+
+static void close_player(player_t *p) {
+	unmark_player_dirty(p);
+	wheel_cancel(&shards[p->shard].wheel, &p->idle);
+	if (!p->closing) {
+		outq_flush(&p->outq, p->fd);   /* last words, if the socket takes them */
+	}
+	event_del(shards[p->shard].loop, p->fd);
+	close(p->fd);
+	p->fd = -1;
+	player_disconnected(p);
+	player_release(p);
+}
+
+/* Players waiting for somebody else aren't idle, anyone else is dropped.
+   Their fd may still be among the events the shard is about to go through,
+   so the actual close is left to flush_players(). */
+static void player_timed_out(void *data) {
+	player_t *p = (player_t *) data;
+	
+	if (p->state == IN_GAME_1 || p->state == IN_GAME_3) {
+		set_player_idle(p);
+		return;
+	}
+	player_print(p, "\r\nYou've been idle for too long. Bye!\r\n");
+	outq_flush(&p->outq, p->fd);       /* last words, if the socket takes them */
+	p->closing = 1;
+	mark_player_dirty(p);
+}
+
+#define PLAYER_QUIT  0    /* the player asked to leave */
+#define PLAYER_OK    1
+#define PLAYER_MOVED 2    /* the player now belongs to another shard */
+
+/* Feeds a command to the player's state machine. */
+static int handle_player_command(player_t *p, char *line) {
+	char *c = trim_string(line);
+	
+	switch (p->state) {
+		case MENU:
+			if (player_menu(p, c) == 5) {
+				return PLAYER_QUIT;
+			}
+			break;
+		case NEW_GAME_1:
+			player_new_game_1(p, c);
+			break;
+		case NEW_GAME_2:
+			player_new_game_2(p, c);
+			break;
+		case NEW_GAME_3:
+			player_new_game_3(p, c);
+			break;
+		case NEW_GAME_4:
+			player_new_game_4(p, c);
+			break;
+		case JOIN_GAME_1:
+			if (!player_join_game_1(p, atoi(c))) {
+				return PLAYER_MOVED;
+			}
+			break;
+		case JOIN_GAME_2:
+			player_join_game_2(p, c);
+			break;
+		case IN_GAME_2:
+			player_in_game_2(p, c);
+			break;
+		case END_GAME_1:
+			player_end_game_1(p);
+			break;
+		case SCORES_1:
+			player_scores_1(p, c);
+			break;
+		case RANK_1:
+			player_rank_1(p, c);
+			break;
+		default:
+			break;
+	}
+	
+	return PLAYER_OK;
+}
+
+static void binary_send_games(player_t *p) {
+	game_t *tmp;
+	unsigned char *frame, *b;
+	size_t count = 0, len = BINARY_HEADER + 2, size = 256;
+	
+	if (!(frame = malloc(size))) {
+		exit_with("malloc error", 1);
+	}
+	
+	pthread_mutex_lock(&games_lock);
+	for (tmp = games.listed_head; tmp && len + 9 <= BINARY_MAX_FRAME; tmp = tmp->listed_next) {
+		if (len + 9 > size) {
+			size *= 2;
+			if (!(frame = realloc(frame, size))) {
+				exit_with("realloc error", 1);
+			}
+		}
+		b = binary_put32(frame + len, tmp->id);
+		*b++ = tmp->cplayers;
+		*b++ = tmp->players;
+		*b++ = tmp->planets;
+		*b++ = tmp->turns;
+		*b++ = tmp->open;
+		len += 9;
+		count++;
+	}
+	pthread_mutex_unlock(&games_lock);
+	
+	binary_put16(binary_frame(frame, BINARY_GAMES, len - BINARY_HEADER), count);
+	player_send_frame(p, frame, len);
+	free(frame);
+}
+
+/* Walks through the new game menus with the numbers we were given and
+   takes the first board that comes up */
+static void binary_create(player_t *p, const unsigned char *data) {
+	static void (*const steps[3])(player_t *, char *) = {
+		player_new_game_1, player_new_game_2, player_new_game_3
+	};
+	char arg[8];
+	int i, game_id = 0;
+	
+	p->state = NEW_GAME_1;
+	for (i = 0; i < 3 && (int) p->state == NEW_GAME_1 + i; i++) {
+		sprintf(arg, "%d", data[i]);
+		steps[i](p, arg);
+	}
+	
+	if (p->state == NEW_GAME_4) {
+		game_id = create_game(p);
+	}
+	free(p->new_game_board);
+	p->new_game_board = NULL;
+	p->state = MENU;
+	
+	binary_reply(p, BINARY_CREATE, game_id ? BINARY_OK : BINARY_FAILED, game_id);
+}
+
+/* One acknowledgement for the lot, like player_batch() */
+static void binary_orders(player_t *p, const unsigned char *data, size_t len) {
+	unsigned char frame[BINARY_HEADER + 4 + 3 * (INBUF_SIZE / BINARY_ORDER_SIZE)];
+	unsigned char *b = frame + BINARY_HEADER + 4;
+	const unsigned char *d;
+	int i, r, count = (len - 1) / BINARY_ORDER_SIZE, failed = 0;
+	game_t *g = find_game_by_id(p->in_game);
+	order_t o;
+	
+	for (i = 0; i < count; i++) {
+		d = data + 1 + i * BINARY_ORDER_SIZE;
+		o.from = d[0];
+		o.to = d[1];
+		o.unit = d[2];
+		o.n = binary_get32(d + 3) & 0x7fffffff;
+		if (o.unit != ORDER_SHIPS && o.unit != ORDER_PERCENT) {
+			r = -2;
+		} else {
+			r = do_move(p, &o, g);
+		}
+		if (r) {
+			b = binary_put16(b, i);
+			*b++ = (unsigned char) r;
+			failed++;
+		}
+	}
+	
+	binary_frame(frame, BINARY_ACK, b - frame - BINARY_HEADER);
+	binary_put16(binary_put16(frame + BINARY_HEADER, count - failed), failed);
+	player_send_frame(p, frame, b - frame);
+	
+	if (data[0] & BINARY_ORDERS_PASS) {
+		player_pass(p, g);
+	}
+}
+
+/* The binary counterpart of handle_player_command() */
+static int handle_binary_request(player_t *p, int type, const unsigned char *data, size_t len) {
+	unsigned char state[BINARY_STATE_SIZE];
+	char nickname[MAX_NICK_LEN + 1];
+	int game_id;
+	
+	switch (type) {
+		case BINARY_LIST:
+			if (p->state != MENU) {
 				break;
-			case -2:
-				strcpy(response, "You're doing it wrong.\r\n");
+			}
+			binary_send_games(p);
+			return PLAYER_OK;
+		case BINARY_CREATE:
+			if (p->state != MENU) {
 				break;
-			case 1:
-				strcpy(response, "Wrong source planet buddy.\r\n");
+			}
+			if (len != 3) {
+				binary_reply(p, type, BINARY_BAD_REQUEST, 0);
+				return PLAYER_OK;
+			}
+			binary_create(p, data);
+			return PLAYER_OK;
+		case BINARY_JOIN:
+			if (p->state != MENU) {
+				break;
+			}
+			if (len != 4) {
+				binary_reply(p, type, BINARY_BAD_REQUEST, 0);
+				return PLAYER_OK;
+			}
+			game_id = binary_get32(data) & 0x7fffffff;
+			p->state = JOIN_GAME_1;
+			if (!player_join_game_1(p, game_id)) {
+				return PLAYER_MOVED;    /* the new shard replies, see adopt_players() */
+			}
+			binary_reply_join(p, game_id);
+			return PLAYER_OK;
+		case BINARY_NICK:
+			if (p->state != JOIN_GAME_2) {
+				break;
+			}
+			if (len > MAX_NICK_LEN) {
+				len = MAX_NICK_LEN;
+			}
+			memcpy(nickname, data, len);
+			nickname[len] = '\0';
+			game_id = -p->in_game;
+			player_join_game_2(p, nickname);
+			binary_reply(p, type, p->in_game > 0 ? BINARY_OK : BINARY_FAILED, game_id);
+			return PLAYER_OK;
+		case BINARY_ORDERS:
+			if (p->state != IN_GAME_2) {
+				break;
+			}
+			if (!len || (len - 1) % BINARY_ORDER_SIZE) {
+				binary_reply(p, type, BINARY_BAD_REQUEST, p->in_game);
+				return PLAYER_OK;
+			}
+			binary_orders(p, data, len);
+			return PLAYER_OK;
+		case BINARY_BOARD:
+			if (p->in_game <= 0) {
 				break;
-			case 2:
-				strcpy(response, "You don't own that planet.\r\n");
+			}
+			player_send_frame(p, state, binary_state(state, find_game_by_id(p->in_game)));
+			return PLAYER_OK;
+		case BINARY_LEAVE:
+			if (p->state != END_GAME_1) {
+				break;
+			}
+			game_id = p->in_game;
+			player_end_game_1(p);
+			binary_reply(p, type, BINARY_OK, game_id);
+			return PLAYER_OK;
+		case BINARY_QUIT:
+			return PLAYER_QUIT;
+		default:
+			binary_reply(p, type, BINARY_BAD_REQUEST, 0);
+			return PLAYER_OK;
+	}
+	
+	binary_reply(p, type, BINARY_BAD_STATE, p->in_game < 0 ? -p->in_game : p->in_game);
+	return PLAYER_OK;
+}
+
+/* Like process_player_input(), for frames. A frame that can't fit in the
+   input buffer is a protocol error and gets the client dropped. */
+static int process_binary_input(player_t *p) {
+	unsigned char frame[INBUF_SIZE];
+	size_t len;
+	int r;
+	
+	while (p->inlen >= 2) {
+		len = binary_get16((unsigned char *) p->inbuf);
+		if (!len || len > INBUF_SIZE - 3) {
+			p->inlen = 0;
+			p->closing = 1;
+			mark_player_dirty(p);
+			break;
+		}
+		if (p->inlen < len + 2) {
+			break;
+		}
+		
+		memcpy(frame, p->inbuf + 2, len);
+		p->inlen -= len + 2;
+		memmove(p->inbuf, p->inbuf + len + 2, p->inlen);
+		
+		if ((r = handle_binary_request(p, frame[0], frame + 1, len - 1)) != PLAYER_OK) {
+			return r;
+		}
+	}
+	
+	return PLAYER_OK;
+}
+
+/* Runs every complete line waiting in the player's input buffer through
+   the state machine. Lines end in LF, CR LF or a bare CR (telnet sends
+   CR NUL). Each line is moved out of the buffer before it's handled, since
+   the handler may hand the player over to another shard, which then picks
+   up the rest of the buffer. */
+static int process_player_input(player_t *p) {
+	char line[INBUF_SIZE];
+	size_t i, len;
+	int r;
+	
+	if (p->binary) {
+		return process_binary_input(p);
+	}
+	
+	while (p->inlen) {
+		if (p->skip_lf) {                /* second half of CR LF / CR NUL */
+			p->skip_lf = 0;
+			if (p->inbuf[0] == '\n' || p->inbuf[0] == '\0') {
+				memmove(p->inbuf, p->inbuf + 1, --p->inlen);
+				continue;
+			}
+		}
+		
+		for (i = 0; i < p->inlen && p->inbuf[i] != '\n' && p->inbuf[i] != '\r'; i++);
+		
+		if (i == p->inlen) {             /* incomplete line */
+			if (p->inlen == INBUF_SIZE - 1) {
+				p->inlen = 0;            /* way too long, throw it away */
+				p->discarding = 1;
+			}
+			break;
+		}
+		
+		len = i;
+		memcpy(line, p->inbuf, len);
+		line[len] = '\0';
+		p->skip_lf = p->inbuf[i] == '\r';
+		p->inlen -= i + 1;
+		memmove(p->inbuf, p->inbuf + i + 1, p->inlen);
+		
+		if (p->discarding) {             /* tail of the line we threw away */
+			p->discarding = 0;
+			continue;
+		}
+		
+		if ((r = handle_player_command(p, line)) != PLAYER_OK) {
+			return r;
+		}
+	}
+	
+	return PLAYER_OK;
+}
+
+/* Reads everything the client has sent us. Since we're edge-triggered we
+   must keep reading until the socket runs dry. */
+static void handle_player_input(player_t *p) {
+	ssize_t n;
+	
+	if (p->closing) {
+		return;                              /* dropped at the next flush */
+	}
+	
+	while (1) {
+		switch (process_player_input(p)) {
+			case PLAYER_QUIT:
+				close_player(p);
+				return;
+			case PLAYER_MOVED:
+				return;
+			default:
 				break;
-			case 3:
-				strcpy(response, "You can't attack that planet.\r\n");
+		}
+		
+		if (p->closing) {
+			return;                          /* dropped at the next flush */
+		}
+		
+		n = read(p->fd, p->inbuf + p->inlen, INBUF_SIZE - 1 - p->inlen);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;                          /* drained */
+		} else if (n <= 0) {                 /* client disconnected or error */
+			close_player(p);
+			return;
+		}
+		p->inlen += n;
+		set_player_idle(p);
+	}
+}
+
+/* Takes over players that other shards handed to us and lets them finish
+   joining the game they asked for. Whatever else they typed meanwhile is
+   still in their input buffer and gets processed right after. */
+static void adopt_players(shard_t *s) {
+	player_t *p, *next;
+	
+	for (p = shard_take_inbox(s); p; p = next) {
+		next = p->next;
+		p->shard = s->id;
+		if (event_add(s->loop, p->fd, EV_READ, p) < 0) {
+			close(p->fd);
+			p->fd = -1;
+			player_disconnected(p);
+			player_release(p);
+			continue;
+		}
+		set_player_idle(p);
+		if (player_join_game_1(p, p->handoff_game)) {
+			if (p->binary) {
+				binary_reply_join(p, p->handoff_game);
+			}
+			handle_player_input(p);
+		}
+	}
+}
+
+/* Writes out everything queued during this batch of events. Clients whose
+   sockets are full get EV_WRITE interest until they drain, clients that
+   let their queue pile up past OUTQ_HIGH_WATER are disconnected. Closing a
+   player may queue messages for others, hence the loop. */
+static void flush_players(shard_t *s) {
+	player_t *p;
+	
+	while ((p = s->dirty)) {
+		unmark_player_dirty(p);
+		
+		if (p->closing) {
+			close_player(p);
+			continue;
+		}
+		
+		switch (outq_flush(&p->outq, p->fd)) {
+			case 1:
+				if (p->want_write) {
+					event_mod(s->loop, p->fd, EV_READ, p);
+					p->want_write = 0;
+				}
 				break;
-			case 4:
-				strcpy(response, "You can has ships, not.\r\n");
+			case 0:
+				if (!p->want_write) {
+					event_mod(s->loop, p->fd, EV_READ | EV_WRITE, p);
+					p->want_write = 1;
+				}
 				break;
 			default:
+				close_player(p);
 				break;
 		}
 	}
+}
+
+static void accept_players(shard_t *s, int listenfd, int binary) {
+	int connfd;
+	socklen_t len;
+	struct sockaddr_in cliaddr;
+	player_t *p;
+	unsigned char hello[BINARY_HEADER + 1];
 	
-	if (strlen(response)) {
-		write(p->fd, response, strlen(response));
+	while (1) {
+		len = sizeof(cliaddr);
+		connfd = accept(listenfd, (struct sockaddr *) &cliaddr, &len);
+		
+		if (connfd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("accept error");
+			}
+			return;
+		}
+		
+		fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK);
+		
+		p = player_new(connfd, s->id);
+		p->binary = binary;
+		timeout_init(&p->idle, player_timed_out, p);
+		if (event_add(s->loop, connfd, EV_READ, p) < 0) {   /* no room left */
+			if (!binary) {
+				write(connfd, "Too many clients. Try again later.\r\n", 36);
+			}
+			close(connfd);
+			player_release(p);
+			continue;
+		}
+		set_player_idle(p);
+		if (binary) {
+			*binary_frame(hello, BINARY_HELLO, 1) = BINARY_VERSION;
+			player_send_frame(p, hello, sizeof(hello));
+		} else {
+			show_menu_to_player(p);
+		}
 	}
+}
+
+static void *shard_main(void *arg) {
+	int i, nready;
+	shard_t *s = (shard_t *) arg;
+	player_t *p;
+	fired_event_t fired[MAX_FIRED_EVENTS];
 	
-	if (strcasecmp(cmd, "pass")) {
-		prompt_player_for_move(p);
+	while (1) {
+		nready = event_wait(s->loop, fired, MAX_FIRED_EVENTS, wheel_timeout(&s->wheel));
+		
+		if (nready < 0) {
+			exit_with("event_wait error", 1);
+		}
+		wheel_run(&s->wheel);    /* timeouts first, so the clock is current */
+		
+		for (i = 0; i < nready; i++) {
+			if (fired[i].data == &s->listenfd) {    /* we have new connections */
+				accept_players(s, s->listenfd, 0);
+			} else if (fired[i].data == &s->binlistenfd) {
+				accept_players(s, s->binlistenfd, 1);
+			} else if (fired[i].data == s->wakefd) {   /* players handed to us */
+				adopt_players(s);
+			} else {
+				p = (player_t *) fired[i].data;
+				if (fired[i].events & EV_WRITE) {
+					mark_player_dirty(p);
+				}
+				if (fired[i].events & EV_READ) {
+					handle_player_input(p);
+				}
+			}
+		}
+		
+		flush_players(s);
 	}
+	
+	return NULL;
 }
 
-static void player_end_game_1(player_t *p, game_node_t *game_list) {
-	game_t *tmp;
+/* With SO_REUSEPORT every shard gets a listener of its own and the kernel
+   spreads connections among them, otherwise they all share the first one. */
+static int open_listener(int lport) {
+	int listenfd, one = 1;
+	struct sockaddr_in servaddr;
 	
-	tmp = find_game_by_id(p->in_game, game_list);
-	tmp->cplayers--;
-	p->in_game = 0;
-	show_menu_to_player(p);
-	p->state = MENU;
+	listenfd = socket(AF_INET, SOCK_STREAM, 0);
+	
+	if (listenfd < 0) {
+		exit_with("socket error", 1);
+	}
+	
+	if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (void *) &one, sizeof(int)) < 0) {
+		exit_with("setsockopt error", 1);
+	}
+	
+#ifdef SO_REUSEPORT
+	if (nshards > 1 && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (void *) &one, sizeof(int)) < 0) {
+		exit_with("setsockopt error", 1);
+	}
+#endif
+	
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	servaddr.sin_port = htons(lport ? lport : DFLPORT);
+	
+	if (bind(listenfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0) {
+		exit_with("bind error", 1);
+	}
+	
+	if (listen(listenfd, LISTENQ) < 0) {
+		exit_with("listen error", 1);
+	}
+	
+	if (fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+		exit_with("fcntl error", 1);
+	}
+	
+	return listenfd;
+}
+
+static void raise_fd_limit() {
+	struct rlimit rl;
+	
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/* Brings back the games in the journal. Every seat is empty until its
+   player comes back for it, see rejoin_game(). Has to run before the
+   shards do. */
+static void restore_games() {
+	game_t *g;
+	int slot;
+	
+	for (slot = 0; slot < JOURNAL_SLOTS; slot++) {
+		if (!(g = calloc(1, sizeof(game_t)))) {
+			exit_with("calloc error", 1);
+		}
+		if (!journal_load(g, slot)) {
+			free(g);
+			continue;
+		}
+		
+		g->started = 1;
+		g->restoring = 1;
+		g->vacant = g->alive;
+		g->screen = screen_new(g);
+		g->shard = (g->id - 1) % nshards;
+		registry_restore(&games, g);
+		
+		timeout_init(&g->deadline, game_timed_out, g);
+		set_game_deadline(g, lobby_time);
+	}
 }
 
 int main(int argc, char *argv[]) {
-	int i, r, maxi, maxfd, lport = 0, listenfd, connfd, sockfd, nready, opt;
+	int i, lport = 0, binport = 0, opt;
 	int is_daemon = 0;
-	int one = 1;
-	socklen_t len;
-	player_t client[FD_SETSIZE];
-	ssize_t n;
-	fd_set rset, allset;
-	char *c, buffer[1024];
-	struct sockaddr_in cliaddr, servaddr;
-	game_node_t *game_list = NULL;
 	int option_index = 0;
-	char *version;
+	char *version, *qrbg_host = QRBG_HOST, *c;
+	unsigned int qrbg_port = QRBG_PORT;
+	int fixed_seed = 0;
+	int flush_interval = FLUSH_INTERVAL;
+	int restore = 0;
+	char *replay_dir = NULL;
+	uint64_t seed = 0;
 	struct option long_options[] = {
 		{"really-random", 0, 0, 'r'},
-		{"version", 0, 0, 'v'}
+		{"threads", 1, 0, 't'},
+		{"combat", 1, 0, 'c'},
+		{"qrbg-server", 1, 0, 'q'},
+		{"seed", 1, 0, 's'},
+		{"binary-port", 1, 0, 'b'},
+		{"turn-time", 1, 0, 'T'},
+		{"idle-time", 1, 0, 'I'},
+		{"lobby-time", 1, 0, 'L'},
+		{"flush-interval", 1, 0, 'f'},
+		{"restore", 0, 0, 'R'},
+		{"replay-dir", 1, 0, 'D'},
+		{"version", 0, 0, 'v'},
+		{0, 0, 0, 0}
 	};
 	
+#ifdef _SC_NPROCESSORS_ONLN
+	nshards = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	
 	/* Parse command-line options */
-	while ((opt = getopt_long(argc, argv, "vdp:", long_options, &option_index)) != -1) {
+	while ((opt = getopt_long(argc, argv, "vdp:t:", long_options, &option_index)) != -1) {
 		switch (opt) {
 			case 'v':
 #ifdef VERSION
@@ -1054,169 +2088,149 @@ int main(int argc, char *argv[]) {
 			case 'r':
 				really_random = 1;
 				break;
+			case 't':
+				nshards = atoi(optarg);
+				break;
+			case 'c':
+				if (!strcmp(optarg, "sampled")) {
+					combat_mode = COMBAT_SAMPLED;
+				} else if (!strcmp(optarg, "per-ship")) {
+					combat_mode = COMBAT_PER_SHIP;
+				} else {
+					fprintf(stderr, "Unknown combat engine: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'q':
+				qrbg_host = optarg;
+				if ((c = strrchr(optarg, ':'))) {
+					*c = '\0';
+					qrbg_port = atoi(c + 1);
+				}
+				break;
+			case 's':
+				fixed_seed = 1;
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'b':
+				binport = atoi(optarg);
+				break;
+			case 'T':
+				turn_time = atoi(optarg);
+				break;
+			case 'I':
+				idle_time = atoi(optarg);
+				break;
+			case 'L':
+				lobby_time = atoi(optarg);
+				break;
+			case 'f':
+				flush_interval = atoi(optarg);
+				break;
+			case 'R':
+				restore = 1;
+				break;
+			case 'D':
+				replay_dir = optarg;
+				break;
 			default:
 			case '?':
-				fprintf(stderr, "Usage: %s [-d] [-p port] [--really-random]\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-d] [-p port] [-t threads] [--combat=per-ship|sampled]"
+				        " [--really-random]"
+				        " [--qrbg-server=host[:port]]"
+				        " [--seed=n] [--binary-port=port]"
+				        " [--turn-time=s] [--idle-time=s] [--lobby-time=s]"
+				        " [--flush-interval=ms] [--restore]"
+				        " [--replay-dir=dir]\n", argv[0]);
 				exit(1);
 		}
 	}
-	listenfd = socket(AF_INET, SOCK_STREAM, 0);
 	
-	if (listenfd < 0) {
-		exit_with("socket error", 1);
+	/* The timer wheel doesn't go much further than a couple of weeks */
+	if (turn_time > MAX_TIME) {
+		turn_time = MAX_TIME;
 	}
-	
-	if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (void *) &one, sizeof(int)) < 0) {
-		exit_with("setsockopt error", 1);
+	if (idle_time > MAX_TIME) {
+		idle_time = MAX_TIME;
+	}
+	if (lobby_time > MAX_TIME) {
+		lobby_time = MAX_TIME;
 	}
 	
-	memset(&servaddr, 0, sizeof(servaddr));
-	servaddr.sin_family = AF_INET;
-	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	servaddr.sin_port = htons(lport ? lport : DFLPORT);
-	
-	if (bind(listenfd, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0) {
-		exit_with("bind error", 1);
+	if (flush_interval < 1) {
+		flush_interval = 1;
 	}
 	
-	if (listen(listenfd, LISTENQ) < 0) {
-		exit_with("listen error", 1);
+	if (nshards < 1) {
+		nshards = 1;
+	} else if (nshards > MAX_SHARDS) {
+		nshards = MAX_SHARDS;
 	}
 	
-	maxfd = listenfd;    /* lazy pointer to the biggest fd (for select) */
-	maxi = -1;           /* lazy pointer to the biggest index in client[] */
+	raise_fd_limit();
+	registry_init(&games);
+	signal(SIGPIPE, SIG_IGN);    /* write errors are handled where they occur */
 	
-	for (i = 0; i < FD_SETSIZE ; i++) {
-		client[i].fd = -1;    /* -1 indicates available entry */
+	if (really_random) {
+		QRBG_init(qrbg_host, qrbg_port); /* Initiate QRBG service */
 	}
+	if (fixed_seed) {
+		rng_set_seed_source(RNG_SEED_FIXED, seed);
+	} else if (really_random) {
+		rng_set_seed_source(RNG_SEED_QRBG, 0);
+	}
+	scoreboard_init(flush_interval);     /* Initiate our scoreboard database */
 	
-	FD_ZERO(&allset);
-	FD_SET(listenfd, &allset);
-	if (really_random) {
-		QRBG_init();                     /* Initiate QRBG service */
-	} else {
-		srandom(time(NULL) + getpid());  /* I can has random numbers? kthxbai */
+	for (i = 0; i < nshards; i++) {
+		shard_init(&shards[i], i);
+#ifdef SO_REUSEPORT
+		shards[i].listenfd = open_listener(lport);
+#else
+		shards[i].listenfd = i ? shards[0].listenfd : open_listener(lport);
+#endif
+		if (event_add(shards[i].loop, shards[i].listenfd, EV_READ, &shards[i].listenfd) < 0) {
+			exit_with("event_add error", 1);
+		}
+		
+		if (!binport) {
+			continue;
+		}
+#ifdef SO_REUSEPORT
+		shards[i].binlistenfd = open_listener(binport);
+#else
+		shards[i].binlistenfd = i ? shards[0].binlistenfd : open_listener(binport);
+#endif
+		if (event_add(shards[i].loop, shards[i].binlistenfd, EV_READ, &shards[i].binlistenfd) < 0) {
+			exit_with("event_add error", 1);
+		}
+	}
+	
+	/* Games in progress are snapshotted every turn, see journal.h */
+	journal_open(JOURNAL_FILE, restore);
+	if (restore) {
+		restore_games();
+	}
+	if (replay_dir) {
+		replay_init(replay_dir);         /* Log every game, see replay.h */
 	}
-	scoreboard_init();                   /* Initiate our scoreboard database */
 	
 	if (is_daemon) {
 		daemon(0,0);
 	}
 	
-	while (1) {
-		rset = allset;
-		
-		nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
-		
-		if (nready < 0) {
-			exit_with("select error", 1);
-		}
-		
-		if (FD_ISSET(listenfd, &rset)) {    /* we have a new connection */
-			len = sizeof(cliaddr);
-			
-			connfd = accept(listenfd, (struct sockaddr *) &cliaddr, &len);
-			
-			if (connfd < 0) {
-				exit_with("accept error", 1);
-			}
-			
-			for (i=0; i<FD_SETSIZE; i++) { /* find empty slot in client array */
-				if (client[i].fd < 0) {
-					client[i].fd = connfd;    /* record client's connected fd */
-					client[i].in_game = 0;
-					client[i].new_game_board = NULL;
-					client[i].state = MENU;
-					show_menu_to_player(&client[i]);   /* show menu to player */
-					FD_SET(connfd, &allset);
-					if (connfd > maxfd) {
-						maxfd = connfd;
-					}
-					if (i > maxi) {
-						maxi = i;
-					}
-					break;
-				}
-			}
-			
-			if (i == FD_SETSIZE) {    /* no slots available */
-				write(connfd, "Too many clients. Try again later.\r\n", 40);
-				close(connfd);
-			}
-			
-			/* if no other descriptors are ready (according to select) then
-			   skip the following loop */
-			if (--nready <= 0) {
-				continue;
-			}
-		}
-		
-		for (i=0; i<=maxi; i++) {                /* check clients for data */
-			if ((sockfd = client[i].fd) < 0) {   /* empty slot, let's skip it */
-				continue;
-			}
-			
-			if (FD_ISSET(sockfd, &rset)) {
-				memset(buffer, 0, sizeof(buffer));
-				n = read(sockfd, buffer, 1024);
-				if (n == -1) {                   /* read error */
-					/* do nothing */
-				} else if (n == 0) {             /* client disconnected */
-					close(sockfd);
-					FD_CLR(sockfd, &allset);
-					client[i].fd = -1;
-					player_disconnected(&client[i], game_list);
-				} else {
-					if ((c = strchr(buffer, '\r')) > 0 || (c = strchr(buffer, '\n')) > 0) {
-						*c = '\0';
-					}
-					c = trim_string(buffer);
-					switch (client[i].state) {
-						case MENU:
-							r = player_menu(&client[i], c, game_list);
-							if (r == 5) {
-								close(sockfd);
-								FD_CLR(sockfd, &allset);
-								client[i].fd = -1;
-								player_disconnected(&client[i], game_list);
-							}
-							break;
-						case NEW_GAME_1:
-							player_new_game_1(&client[i], c);
-							break;
-						case NEW_GAME_2:
-							player_new_game_2(&client[i], c);
-							break;
-						case NEW_GAME_3:
-							player_new_game_3(&client[i], c);
-							break;
-						case NEW_GAME_4:
-							player_new_game_4(&client[i], c, &game_list);
-							break;
-						case JOIN_GAME_1:
-							player_join_game_1(&client[i], c, game_list);
-							break;
-						case JOIN_GAME_2:
-							player_join_game_2(&client[i], c, game_list);
-							break;
-						case IN_GAME_2:
-							player_in_game_2(&client[i], c, game_list);
-							break;
-						case END_GAME_1:
-							player_end_game_1(&client[i], game_list);
-							break;
-						default:
-							break;
-					}
-				}
-				
-				/* no more descriptors require processing? call select again */
-				if (--nready <= 0) {
-					break;
-				}
-			}
+	scoreboard_start();                  /* Before any thread, see scoreboard.c */
+	
+	if (really_random) {
+		QRBG_start();                    /* Keep the entropy pools topped up */
+	}
+	
+	/* The main thread doubles as the first shard */
+	for (i = 1; i < nshards; i++) {
+		if (pthread_create(&shards[i].thread, NULL, shard_main, &shards[i])) {
+			exit_with("pthread_create error", 0);
 		}
 	}
+	shard_main(&shards[0]);
 	
 	return 0;
 }
@@ -22,6 +22,10 @@
 #define MAX_TURNS 99
 #define BOARD_SIZE 16
 #define MAX_NICK_LEN 15
+#define MOVE_SLOTS 32      /* power of two, longer than the longest trip */
+#define INBUF_SIZE 1024
+#define BATCH_ERRORS 8            /* rejected bulk orders that get reported */
+#define NOBODY -1                 /* owner of a neutral planet */
 
 typedef enum player_state_e {
 	MENU,               /* player is asked to pick an option from the menu */
@@ -34,46 +38,93 @@ typedef enum player_state_e {
 	IN_GAME_1,          /* player has joined a game and is waiting to start */
 	IN_GAME_2,          /* player is asked for this turn's commands */
 	IN_GAME_3,          /* player has entered his commands */
-	END_GAME_1          /* the game has just ended */
+	END_GAME_1,         /* the game has just ended */
+	SCORES_1,           /* player is paging through the high scores */
+	RANK_1              /* player is asked for a nickname to look up */
 } player_state_t;
 
-typedef struct board_node_s {
-	int x;
-	int y;
-	char name;
-	char *owner;
-	int ships, prod, attack;
-} board_node_t;
-
+/* The planets of a board, one array per attribute and indexed by planet
+   (A is 0). The rest of the map is empty space, so only the coordinates of
+   the planets are kept. Owners are player ids, see game_t. */
 typedef struct board_s {
-	board_node_t nodes[BOARD_SIZE][BOARD_SIZE];
+	int ships[MAX_PLANETS];
+	int prod[MAX_PLANETS];
+	int attack[MAX_PLANETS];
+	signed char owner[MAX_PLANETS];
+	unsigned char x[MAX_PLANETS], y[MAX_PLANETS];
 } board_t;
 
 typedef struct player_s {
 	int fd, in_game;
+	int binary;                   /* speaks binary.h instead of text */
+	int id;                       /* seat in the game, see game_t */
 	player_state_t state;
 	char nickname[MAX_NICK_LEN + 1];
 	int new_game_players, new_game_planets, new_game_turns;
 	board_t *new_game_board;
+	rng_t new_game_rng;           /* the stream new_game_board came from */
+	int shard, handoff_game;
+	struct player_s *next;        /* free list or shard inbox link */
+	char inbuf[INBUF_SIZE];       /* partial line read from the client */
+	size_t inlen;
+	int skip_lf, discarding;
+	outq_t outq;
+	int want_write, closing, dirty;
+	struct player_s *dirty_prev, *dirty_next;
+	int ansi;                     /* gets screen updates as ANSI diffs */
+	unsigned int screen_gen;      /* screen generation the client has seen */
+	int scores_page;              /* high score page they're looking at */
+	timeout_t idle;               /* drops them if they stop typing */
+	int batch;                    /* sending orders in bulk */
+	int batch_orders, batch_failed;
+	int batch_errors[BATCH_ERRORS][2];    /* order number and do_move() error */
 } player_t;
 
+/* Implemented in galacticd.c */
+void player_send(player_t *p, const char *buf, size_t len);
+
+void player_print(player_t *p, const char *msg);
+
 typedef struct move_s {
-	player_t *owner;
-	board_node_t *target;
+	int owner;                    /* player id, see game_t */
+	int target;                   /* planet index */
 	int ships;
 	int attack;
-	struct move_s *next;
 } move_t;
 
+/* Every fleet arriving on a given turn, in the order they were sent. The
+   index finds a fleet to merge with in O(1), see moves.c. */
+typedef struct move_batch_s {
+	move_t *moves;
+	int count, size;
+	int *index;
+} move_batch_t;
+
 typedef struct game_s {
 	int players, planets, turns, cplayers, cturn, rplayers, id, open;
-	board_t board;
+	int started, over;
+	int shard;                    /* the only thread allowed to touch us */
+	rng_t rng;                    /* every random decision in the game */
+	board_t board;                /* planets A to A+planets-1 */
+	struct screen_s *screen;      /* see screen.h */
+	shared_t *bcast;              /* text for everybody, not queued yet */
+	timeout_t deadline;           /* lobby expiry, then the turn's end */
 	player_t *player_list[MAX_PLAYERS];
-	board_node_t *planet_list[MAX_PLANETS];
-	move_t *moves_list[MAX_TURNS];
+	
+	/* Players are known by a small id for as long as the game lasts, which
+	   is also what owns planets. Their nickname stays behind when they
+	   leave, and so do their planets until the next turn. */
+	char nicknames[MAX_PLAYERS][MAX_NICK_LEN + 1];
+	unsigned int alive;           /* a bit per id still in the game */
+	
+	/* A game brought back by --restore waits for its players to come back
+	   and take their seats again before it goes on */
+	int restoring;
+	unsigned int vacant;          /* a bit per id nobody has reclaimed */
+	int journal;                  /* slot + 1, 0 if none, see journal.h */
+	struct replay_s *replay;      /* see replay.h, NULL if not logged */
+	
+	move_batch_t moves[MOVE_SLOTS];    /* by arrival turn, modulo MOVE_SLOTS */
+	int listed;                   /* see registry.h */
+	struct game_s *listed_prev, *listed_next;
 } game_t;
-
-typedef struct game_node_s {
-	game_t game;
-	struct game_node_s *next;
-} game_node_t;
@@ -0,0 +1,330 @@
+/* journal.c - Keeps a snapshot of every game in progress on disk, so
+   that they survive a restart. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "moves.h"
+#include "binary.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x47544a31    /* "GTJ1" */
+#define JOURNAL_HEADER 16
+#define JOURNAL_MOVE 11             /* bytes per fleet */
+
+static unsigned char *journal;
+
+/* Slots not taken by any game, lowest on top */
+static int free_slots[JOURNAL_SLOTS], nfree;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned char *journal_copy(int slot, int i) {
+	return journal + ((size_t) slot * 2 + i) * JOURNAL_COPY;
+}
+
+/* FNV-1a, seeded with the rest of the header so that a header torn
+   between two snapshots doesn't check out either */
+static uint32_t journal_sum(const unsigned char *b, uint32_t len, uint32_t seq) {
+	uint32_t h = 2166136261u ^ seq ^ (len << 16);
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ b[i]) * 16777619u;
+	}
+	return h;
+}
+
+/* The copy's sequence number, 0 if it doesn't hold a snapshot */
+static uint32_t copy_seq(const unsigned char *c) {
+	return binary_get32(c) == JOURNAL_MAGIC ? binary_get32(c + 4) : 0;
+}
+
+/* Like copy_seq(), but the snapshot has to check out too */
+static uint32_t copy_valid(const unsigned char *c) {
+	uint32_t seq = copy_seq(c), len = binary_get32(c + 8);
+
+	if (!seq || len > JOURNAL_COPY - JOURNAL_HEADER ||
+	    binary_get32(c + 12) != journal_sum(c + JOURNAL_HEADER, len, seq)) {
+		return 0;
+	}
+	return seq;
+}
+
+static void slot_free(int slot) {
+	binary_put32(journal_copy(slot, 0), 0);
+	binary_put32(journal_copy(slot, 1), 0);
+
+	pthread_mutex_lock(&slots_lock);
+	free_slots[nfree++] = slot;
+	pthread_mutex_unlock(&slots_lock);
+}
+
+/* Maps the journal at path, creating it if need be. Unless keep is set,
+   whatever it held is thrown away; otherwise the slots with a snapshot in
+   them stay taken until journal_load() has had a look at them. */
+void journal_open(const char *path, int keep) {
+	size_t size = (size_t) JOURNAL_SLOTS * 2 * JOURNAL_COPY;
+	int fd, slot;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		exit_with("open error", 1);
+	}
+	/* The file is sparse, only the slots in use take up room */
+	if ((!keep && ftruncate(fd, 0) < 0) || ftruncate(fd, size) < 0) {
+		exit_with("ftruncate error", 1);
+	}
+	journal = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (journal == MAP_FAILED) {
+		exit_with("mmap error", 1);
+	}
+	close(fd);
+
+	for (slot = JOURNAL_SLOTS - 1; slot >= 0; slot--) {
+		if (!keep || (!copy_valid(journal_copy(slot, 0)) && !copy_valid(journal_copy(slot, 1)))) {
+			free_slots[nfree++] = slot;
+		}
+	}
+}
+
+static unsigned char *put64(unsigned char *b, uint64_t v) {
+	b = binary_put32(b, v >> 32);
+	return binary_put32(b, v);
+}
+
+static uint64_t get64(const unsigned char *b) {
+	return ((uint64_t) binary_get32(b) << 32) | binary_get32(b + 4);
+}
+
+static size_t journal_encode(unsigned char *buf, game_t *g) {
+	unsigned char *b = buf, *count;
+	move_batch_t *mb;
+	move_t *m;
+	int i, j, k, len, n = 0;
+
+	b = binary_put32(b, g->id);
+	*b++ = g->players;
+	*b++ = g->planets;
+	*b++ = g->turns;
+	*b++ = g->cturn;
+	b = binary_put16(b, g->alive);
+	b = put64(b, g->rng.seed);
+	for (i = 0; i < 4; i++) {
+		b = put64(b, g->rng.s[i]);
+	}
+
+	for (i = 0; i < g->players; i++) {
+		len = strlen(g->nicknames[i]);
+		*b++ = len;
+		memcpy(b, g->nicknames[i], len);
+		b += len;
+	}
+
+	for (i = 0; i < g->planets; i++) {
+		*b++ = g->board.x[i];
+		*b++ = g->board.y[i];
+		*b++ = (unsigned char) g->board.owner[i];
+		b = binary_put32(b, g->board.ships[i]);
+		b = binary_put32(b, g->board.prod[i]);
+		b = binary_put32(b, g->board.attack[i]);
+	}
+
+	count = b;
+	b += 2;
+	for (k = 0; k < MOVE_SLOTS; k++) {
+		mb = &g->moves[(g->cturn + k) & (MOVE_SLOTS - 1)];
+		for (j = 0; j < mb->count; j++, n++) {
+			m = &mb->moves[j];
+			*b++ = k;
+			*b++ = m->owner;
+			*b++ = m->target;
+			b = binary_put32(b, m->ships);
+			b = binary_put32(b, m->attack);
+		}
+	}
+	binary_put16(count, n);
+
+	return b - buf;
+}
+
+/* Bytes journal_encode() is going to need for g */
+static size_t journal_size(game_t *g) {
+	size_t size = 52 + 15 * g->planets;
+	int i;
+
+	for (i = 0; i < g->players; i++) {
+		size += 1 + strlen(g->nicknames[i]);
+	}
+	for (i = 0; i < MOVE_SLOTS; i++) {
+		size += JOURNAL_MOVE * g->moves[i].count;
+	}
+
+	return size;
+}
+
+/* Writes g over the older of its slot's copies. Only g's own shard may
+   call this. Games that don't fit, or find no free slot, go without. */
+void journal_save(game_t *g) {
+	unsigned char *c;
+	uint32_t seq0, seq1, len;
+
+	if (!g->journal) {
+		pthread_mutex_lock(&slots_lock);
+		if (nfree) {
+			g->journal = free_slots[--nfree] + 1;
+		}
+		pthread_mutex_unlock(&slots_lock);
+		if (!g->journal) {
+			return;
+		}
+	}
+
+	/* Only with thousands of fleets in the air */
+	if (journal_size(g) > JOURNAL_COPY - JOURNAL_HEADER) {
+		journal_drop(g);
+		return;
+	}
+
+	seq0 = copy_seq(journal_copy(g->journal - 1, 0));
+	seq1 = copy_seq(journal_copy(g->journal - 1, 1));
+	c = journal_copy(g->journal - 1, seq0 > seq1);
+
+	binary_put32(c, 0);
+	__sync_synchronize();
+	len = journal_encode(c + JOURNAL_HEADER, g);
+	binary_put32(c + 4, (seq0 > seq1 ? seq0 : seq1) + 1);
+	binary_put32(c + 8, len);
+	binary_put32(c + 12, journal_sum(c + JOURNAL_HEADER, len, binary_get32(c + 4)));
+	__sync_synchronize();
+	binary_put32(c, JOURNAL_MAGIC);
+}
+
+/* The game is over, or gone */
+void journal_drop(game_t *g) {
+	if (g->journal) {
+		slot_free(g->journal - 1);
+		g->journal = 0;
+	}
+}
+
+static int journal_decode(game_t *g, const unsigned char *b, uint32_t len) {
+	const unsigned char *end = b + len;
+	int i, k, n, owner, target;
+
+	if (len < 50) {
+		return 0;
+	}
+	g->id = binary_get32(b);
+	g->players = b[4];
+	g->planets = b[5];
+	g->turns = b[6];
+	g->cturn = b[7];
+	g->alive = binary_get16(b + 8);
+	g->rng.seed = get64(b + 10);
+	for (i = 0; i < 4; i++) {
+		g->rng.s[i] = get64(b + 18 + 8 * i);
+	}
+	b += 50;
+
+	if (g->id <= 0 || g->players < 2 || g->players > MAX_PLAYERS || g->alive >> g->players ||
+	    g->planets < g->players || g->planets > MAX_PLANETS ||
+	    g->turns > MAX_TURNS || g->cturn < 1 || g->cturn > g->turns) {
+		return 0;
+	}
+
+	for (i = 0; i < g->players; i++) {
+		if (end - b < 1 || *b > MAX_NICK_LEN || end - b < 1 + *b) {
+			return 0;
+		}
+		memcpy(g->nicknames[i], b + 1, *b);
+		g->nicknames[i][*b] = '\0';
+		b += 1 + *b;
+	}
+
+	if (end - b < 15 * g->planets + 2) {
+		return 0;
+	}
+	for (i = 0; i < g->planets; i++) {
+		g->board.x[i] = b[0];
+		g->board.y[i] = b[1];
+		g->board.owner[i] = (signed char) b[2];
+		g->board.ships[i] = binary_get32(b + 3);
+		g->board.prod[i] = binary_get32(b + 7);
+		g->board.attack[i] = binary_get32(b + 11);
+		if (g->board.x[i] >= BOARD_SIZE || g->board.y[i] >= BOARD_SIZE ||
+		    g->board.owner[i] < NOBODY || g->board.owner[i] >= g->players) {
+			return 0;
+		}
+		b += 15;
+	}
+
+	n = binary_get16(b);
+	b += 2;
+	if (end - b != JOURNAL_MOVE * n) {
+		return 0;
+	}
+	for (; n; n--, b += JOURNAL_MOVE) {
+		k = b[0];
+		owner = b[1];
+		target = b[2];
+		if (k >= MOVE_SLOTS || owner >= g->players || target >= g->planets) {
+			return 0;
+		}
+		moves_add(&g->moves[(g->cturn + k) & (MOVE_SLOTS - 1)], owner, target,
+		          binary_get32(b + 3), binary_get32(b + 7));
+	}
+
+	return 1;
+}
+
+/* Fills the zeroed g in from the newest good copy in slot. Returns 0,
+   and frees the slot, if there is none. */
+int journal_load(game_t *g, int slot) {
+	unsigned char *c;
+	uint32_t seq0, seq1;
+	int i;
+
+	seq0 = copy_valid(journal_copy(slot, 0));
+	seq1 = copy_valid(journal_copy(slot, 1));
+	if (!seq0 && !seq1) {
+		return 0;                       /* already free */
+	}
+	c = journal_copy(slot, seq1 > seq0);
+
+	if (!journal_decode(g, c + JOURNAL_HEADER, binary_get32(c + 8))) {
+		for (i = 0; i < MOVE_SLOTS; i++) {
+			moves_free(&g->moves[i]);
+		}
+		slot_free(slot);
+		return 0;
+	}
+	g->journal = slot + 1;
+
+	return 1;
+}
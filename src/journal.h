@@ -0,0 +1,45 @@
+/* journal.h - Snapshots of the games in progress. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* The journal is a memory-mapped file of fixed-size slots, one per game in
+   progress. A slot holds two copies of the game, written in turns, so that
+   a crash halfway through a snapshot still leaves the previous one. Each
+   copy is a header (u32 magic, u32 sequence number, u32 length, u32
+   checksum) and the snapshot:
+
+     u32 game id, u8 players, u8 planets, u8 turns, u8 turn, u16 alive,
+     u64 seed and u64 state[4] of the rng,
+     per player: u8 length, nickname,
+     per planet: u8 x, u8 y, i8 owner, u32 ships, u32 prod, u32 attack,
+     u16 count, then per fleet on its way: u8 turns until it arrives,
+     u8 owner, u8 target, u32 ships, u32 attack
+
+   Numbers are big-endian, like in binary.h. Snapshots are taken at the
+   start of a turn, so orders given during it are not part of them. */
+#define JOURNAL_FILE "games.journal"
+#define JOURNAL_SLOTS 1024       /* games in progress that can be journaled */
+#define JOURNAL_COPY 16384       /* room for one copy, header included */
+
+void journal_open(const char *path, int keep);
+
+void journal_save(game_t *g);
+
+void journal_drop(game_t *g);
+
+int journal_load(game_t *g, int slot);
@@ -0,0 +1,112 @@
+/* moves.c - Collects the fleets that arrive on the same turn. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "moves.h"
+
+static size_t moves_hash(int owner, int target, int attack) {
+	uint64_t h = (unsigned int) owner * 0x9e3779b97f4a7c15ULL;
+	
+	h = (h ^ (unsigned int) target) * 0xff51afd7ed558ccdULL;
+	h = (h ^ (h >> 33) ^ (unsigned int) attack) * 0xc4ceb9fe1a85ec53ULL;
+	return (size_t) (h ^ (h >> 33));
+}
+
+/* The index has twice as many slots as there is room for moves, which
+   keeps it at most half full */
+static void moves_build_index(move_batch_t *b) {
+	size_t i, mask = 2 * b->size - 1;
+	int j;
+	move_t *m;
+	
+	memset(b->index, 0xff, 2 * b->size * sizeof(int));
+	for (j = 0; j < b->count; j++) {
+		m = &b->moves[j];
+		for (i = moves_hash(m->owner, m->target, m->attack) & mask; b->index[i] >= 0;
+		     i = (i + 1) & mask);
+		b->index[i] = j;
+	}
+}
+
+static void moves_grow(move_batch_t *b) {
+	int size = b->size ? 2 * b->size : MOVE_MIN_SIZE;
+	
+	if (!(b->moves = realloc(b->moves, size * sizeof(move_t)))) {
+		exit_with("realloc error", 1);
+	}
+	free(b->index);
+	if (!(b->index = malloc(2 * size * sizeof(int)))) {
+		exit_with("malloc error", 1);
+	}
+	b->size = size;
+	moves_build_index(b);
+}
+
+/* Queues a fleet, or adds the ships to one that is already on its way with
+   the same owner, target and attack ratio. */
+void moves_add(move_batch_t *b, int owner, int target,
+               int ships, int attack) {
+	size_t i, mask;
+	move_t *m;
+	
+	if (b->count == b->size) {
+		moves_grow(b);
+	}
+	
+	mask = 2 * b->size - 1;
+	for (i = moves_hash(owner, target, attack) & mask; b->index[i] >= 0; i = (i + 1) & mask) {
+		m = &b->moves[b->index[i]];
+		if (m->owner == owner && m->target == target && m->attack == attack) {
+			m->ships += ships;
+			return;
+		}
+	}
+	
+	b->index[i] = b->count;
+	m = &b->moves[b->count++];
+	m->owner = owner;
+	m->target = target;
+	m->ships = ships;
+	m->attack = attack;
+}
+
+/* Empties the batch once its turn is over, the memory is kept for the turn
+   that will reuse it */
+void moves_reset(move_batch_t *b) {
+	if (b->count) {
+		b->count = 0;
+		memset(b->index, 0xff, 2 * b->size * sizeof(int));
+	}
+}
+
+void moves_free(move_batch_t *b) {
+	free(b->moves);
+	free(b->index);
+	b->moves = NULL;
+	b->index = NULL;
+	b->count = b->size = 0;
+}
@@ -0,0 +1,234 @@
+/* outq.c - Buffers what we have to say to a client until its socket is
+   ready to take it. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "common.h"
+#include "outq.h"
+
+shared_t *shared_new(size_t size) {
+	shared_t *b;
+	
+	if (!(b = malloc(sizeof(shared_t))) || !(b->data = malloc(size))) {
+		exit_with("malloc error", 1);
+	}
+	b->refs = 1;
+	b->len = 0;
+	b->size = size;
+	
+	return b;
+}
+
+void shared_append(shared_t *b, const char *buf, size_t len) {
+	while (b->len + len > b->size) {
+		b->size *= 2;
+		if (!(b->data = realloc(b->data, b->size))) {
+			exit_with("realloc error", 1);
+		}
+	}
+	memcpy(b->data + b->len, buf, len);
+	b->len += len;
+}
+
+/* Queues on different shards may hold the same buffer */
+void shared_release(shared_t *b) {
+	if (!__sync_sub_and_fetch(&b->refs, 1)) {
+		free(b->data);
+		free(b);
+	}
+}
+
+void outq_init(outq_t *q) {
+	q->data = NULL;
+	q->size = q->rpos = q->wpos = 0;
+	q->ref_first = q->nrefs = 0;
+	q->shared = 0;
+}
+
+void outq_free(outq_t *q) {
+	while (q->nrefs--) {
+		shared_release(q->refs[q->ref_first].buf);
+		q->ref_first = (q->ref_first + 1) % OUTQ_REFS;
+	}
+	free(q->data);
+	outq_init(q);
+}
+
+size_t outq_pending(outq_t *q) {
+	return q->wpos - q->rpos + q->shared;
+}
+
+/* Makes room for at least need more bytes, unwrapping the pending data to
+   the start of the new buffer. */
+static void outq_grow(outq_t *q, size_t need) {
+	size_t size = q->size ? q->size : OUTQ_MIN_SIZE;
+	size_t pending = q->wpos - q->rpos, off, n;
+	char *data;
+	int i;
+	
+	while (size < pending + need) {
+		size *= 2;
+	}
+	
+	if (!(data = malloc(size))) {
+		exit_with("malloc error", 1);
+	}
+	
+	if (pending) {
+		off = q->rpos & (q->size - 1);
+		n = pending < q->size - off ? pending : q->size - off;
+		memcpy(data, q->data + off, n);
+		memcpy(data + n, q->data, pending - n);
+	}
+	
+	for (i = 0; i < q->nrefs; i++) {
+		q->refs[(q->ref_first + i) % OUTQ_REFS].at -= q->rpos;
+	}
+	
+	free(q->data);
+	q->data = data;
+	q->size = size;
+	q->rpos = 0;
+	q->wpos = pending;
+}
+
+void outq_append(outq_t *q, const char *buf, size_t len) {
+	size_t off, n;
+	
+	if (!len) {
+		return;
+	}
+	
+	if (q->wpos - q->rpos + len > q->size) {
+		outq_grow(q, len);
+	}
+	
+	off = q->wpos & (q->size - 1);
+	n = len < q->size - off ? len : q->size - off;
+	memcpy(q->data + off, buf, n);
+	memcpy(q->data, buf + n, len - n);
+	q->wpos += len;
+}
+
+/* Queues b without copying it, unless it's small enough for a copy to be
+   cheaper or we're already pointing to too many buffers. */
+void outq_append_shared(outq_t *q, shared_t *b) {
+	outq_ref_t *r;
+	
+	if (b->len <= OUTQ_COPY_MAX || q->nrefs == OUTQ_REFS) {
+		outq_append(q, b->data, b->len);
+		return;
+	}
+	
+	__sync_add_and_fetch(&b->refs, 1);
+	r = &q->refs[(q->ref_first + q->nrefs++) % OUTQ_REFS];
+	r->buf = b;
+	r->at = q->wpos;
+	r->off = 0;
+	q->shared += b->len;
+}
+
+/* Fills in the iovecs for the ring bytes between positions from and to */
+static int outq_ring_iov(outq_t *q, size_t from, size_t to, struct iovec *iov) {
+	size_t off, len = to - from;
+	
+	if (!len) {
+		return 0;
+	}
+	
+	off = from & (q->size - 1);
+	iov[0].iov_base = q->data + off;
+	iov[0].iov_len = len < q->size - off ? len : q->size - off;
+	if (iov[0].iov_len == len) {
+		return 1;
+	}
+	iov[1].iov_base = q->data;
+	iov[1].iov_len = len - iov[0].iov_len;
+	
+	return 2;
+}
+
+/* Forgets about the first n bytes, in the order they were queued */
+static void outq_consume(outq_t *q, size_t n) {
+	outq_ref_t *r;
+	size_t k;
+	
+	while (n) {
+		r = q->nrefs ? &q->refs[q->ref_first] : NULL;
+		if (r && q->rpos == r->at) {
+			k = r->buf->len - r->off < n ? r->buf->len - r->off : n;
+			r->off += k;
+			q->shared -= k;
+			n -= k;
+			if (r->off == r->buf->len) {
+				shared_release(r->buf);
+				q->ref_first = (q->ref_first + 1) % OUTQ_REFS;
+				q->nrefs--;
+			}
+		} else {
+			k = (r ? r->at : q->wpos) - q->rpos;
+			k = k < n ? k : n;
+			q->rpos += k;
+			n -= k;
+		}
+	}
+}
+
+/* Writes out as much as the socket takes, using a single writev() for the
+   ring and every shared buffer in it. Returns 1 once drained, 0 if the
+   socket is full and -1 on error. The buffer is given back when empty, idle
+   clients cost nothing. */
+int outq_flush(outq_t *q, int fd) {
+	struct iovec iov[3 * OUTQ_REFS + 2];
+	outq_ref_t *r;
+	size_t pos;
+	ssize_t n;
+	int i, cnt;
+	
+	while (outq_pending(q)) {
+		cnt = 0;
+		pos = q->rpos;
+		for (i = 0; i < q->nrefs; i++) {
+			r = &q->refs[(q->ref_first + i) % OUTQ_REFS];
+			cnt += outq_ring_iov(q, pos, r->at, iov + cnt);
+			iov[cnt].iov_base = r->buf->data + r->off;
+			iov[cnt++].iov_len = r->buf->len - r->off;
+			pos = r->at;
+		}
+		cnt += outq_ring_iov(q, pos, q->wpos, iov + cnt);
+		
+		n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		outq_consume(q, n);
+	}
+	
+	outq_free(q);
+	
+	return 1;
+}
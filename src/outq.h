@@ -0,0 +1,69 @@
+/* outq.h - Output queue structure and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define OUTQ_MIN_SIZE 4096
+#define OUTQ_HIGH_WATER (256 * 1024)    /* clients lagging further get dropped */
+#define OUTQ_REFS 8                     /* shared buffers a queue can point to */
+#define OUTQ_COPY_MAX 128               /* shared buffers this small get copied */
+
+/* Text that goes out to several clients. Queues point to it instead of
+   keeping a copy, the last one to let go frees it. Only the owner appends,
+   before handing it out. */
+typedef struct shared_s {
+	int refs;
+	char *data;
+	size_t len, size;
+} shared_t;
+
+typedef struct outq_ref_s {
+	shared_t *buf;
+	size_t at;                          /* ring position it goes out at */
+	size_t off;                         /* how much of it is already out */
+} outq_ref_t;
+
+/* A ring buffer that grows in powers of two. rpos and wpos are free-running
+   byte counters, their difference is the amount of data waiting. Shared
+   buffers are spliced in between the ring's bytes at the positions they
+   were queued at. */
+typedef struct outq_s {
+	char *data;
+	size_t size;
+	size_t rpos, wpos;
+	outq_ref_t refs[OUTQ_REFS];
+	int ref_first, nrefs;
+	size_t shared;                      /* bytes waiting in shared buffers */
+} outq_t;
+
+shared_t *shared_new(size_t size);
+
+void shared_append(shared_t *b, const char *buf, size_t len);
+
+void shared_release(shared_t *b);
+
+void outq_init(outq_t *q);
+
+void outq_free(outq_t *q);
+
+size_t outq_pending(outq_t *q);
+
+void outq_append(outq_t *q, const char *buf, size_t len);
+
+void outq_append_shared(outq_t *q, shared_t *b);
+
+int outq_flush(outq_t *q, int fd);
@@ -0,0 +1,119 @@
+/* parse.c - Reads the orders players type in. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stddef.h>
+#include "parse.h"
+
+#define COUNT_MAX 1000000000    /* anything bigger is just as wrong */
+
+/* Plain ASCII on purpose, the locale has no say in what's a planet */
+static int is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int is_letter(char c) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static int is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+/* The end of an order is the end of the line or a ';' */
+static int is_end(char c) {
+	return !c || c == ';';
+}
+
+static const char *skip_spaces(const char *s) {
+	while (is_space(*s)) {
+		s++;
+	}
+	return s;
+}
+
+/* Reads a planet letter that must be followed by whitespace */
+static const char *parse_planet(const char *s, int *planet) {
+	if (!is_letter(s[0]) || !is_space(s[1])) {
+		return NULL;
+	}
+	*planet = (s[0] & ~0x20) - 'A';
+	return skip_spaces(s + 1);
+}
+
+static const char *parse_count(const char *s, int *n, int *unit) {
+	if ((s[0] | 0x20) == 'a' && (s[1] | 0x20) == 'l' && (s[2] | 0x20) == 'l') {
+		*n = 100;
+		*unit = ORDER_PERCENT;
+		return s + 3;
+	}
+	
+	if (s[0] < '1' || s[0] > '9') {
+		return NULL;
+	}
+	/* Clamped before the multiplication can overflow: nine digits at most
+	   are read as they are, ten or more make COUNT_MAX */
+	for (*n = 0; is_digit(*s); s++) {
+		*n = *n < COUNT_MAX / 10 ? 10 * *n + (*s - '0') : COUNT_MAX;
+	}
+	if (*s == '%') {
+		*unit = ORDER_PERCENT;
+		return s + 1;
+	}
+	*unit = ORDER_SHIPS;
+	return s;
+}
+
+/* Reads the next order off *line and moves *line past it. Orders are
+   separated by ';' and empty ones are skipped. Returns 1 for an order, 0
+   at the end of the line and -1 if the order makes no sense, in which case
+   *line is left alone. */
+int parse_order(const char **line, order_t *o) {
+	const char *s = *line;
+	
+	for (s = skip_spaces(s); *s == ';'; s = skip_spaces(s + 1));
+	if (!*s) {
+		*line = s;
+		return 0;
+	}
+	
+	if (!(s = parse_planet(s, &o->from)) || !(s = parse_planet(s, &o->to)) ||
+	    !(s = parse_count(s, &o->n, &o->unit))) {
+		return -1;
+	}
+	s = skip_spaces(s);
+	if (!is_end(*s)) {
+		return -1;
+	}
+	
+	*line = *s ? s + 1 : s;
+	return 1;
+}
+
+/* Nicknames are letters, digits and spaces */
+int parse_nickname(const char *nickname) {
+	if (!*nickname) {
+		return 0;
+	}
+	for (; *nickname; nickname++) {
+		if (!is_letter(*nickname) && !is_digit(*nickname) && *nickname != ' ') {
+			return 0;
+		}
+	}
+	return 1;
+}
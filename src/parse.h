@@ -0,0 +1,31 @@
+/* parse.h - Order structure and parser function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define ORDER_SHIPS 0       /* n is a number of ships */
+#define ORDER_PERCENT 1     /* n is a percentage of the ships on the planet */
+
+/* "<from> <to> <n>", where n is a number of ships, a percentage such as
+   "50%" or "all" (which is the same as "100%"). Planets are 0 for A. */
+typedef struct order_s {
+	int from, to, n, unit;
+} order_t;
+
+int parse_order(const char **line, order_t *o);
+
+int parse_nickname(const char *nickname);
@@ -0,0 +1,160 @@
+/* registry.c - Keeps track of the games being played. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "registry.h"
+
+/* Fibonacci hashing: the top bits of the id times 2^64 / phi, which spreads
+   sequential ids evenly over the table */
+static size_t registry_home(registry_t *r, int id) {
+	return ((uint64_t) (unsigned int) id * 0x9E3779B97F4A7C15ull) >> r->shift;
+}
+
+static void registry_place(registry_t *r, game_t *g) {
+	size_t i = registry_home(r, g->id);
+
+	while (r->slots[i]) {
+		i = (i + 1) & (r->size - 1);
+	}
+	r->slots[i] = g;
+}
+
+static void registry_resize(registry_t *r, size_t size) {
+	game_t **old = r->slots;
+	size_t i, old_size = r->size;
+
+	if (!(r->slots = calloc(size, sizeof(game_t *)))) {
+		exit_with("calloc error", 1);
+	}
+	r->size = size;
+	for (r->shift = 64; size > 1; size >>= 1) {
+		r->shift--;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i]) {
+			registry_place(r, old[i]);
+		}
+	}
+	free(old);
+}
+
+void registry_init(registry_t *r) {
+	r->slots = NULL;
+	r->size = r->count = 0;
+	r->next_id = 1;
+	r->listed_head = r->listed_tail = NULL;
+	registry_resize(r, REGISTRY_MIN_SIZE);
+}
+
+/* Assigns the next game id to g, then adds it to the table and the end of
+   the listing. Returns the new id. */
+int registry_insert(registry_t *r, game_t *g) {
+	g->id = r->next_id;
+	registry_restore(r, g);
+
+	return g->id;
+}
+
+/* Like registry_insert(), but g keeps the id it already has, which must
+   not be in use. Later games get ids past it. */
+void registry_restore(registry_t *r, game_t *g) {
+	/* Keep the load factor under 1/2 so probe sequences stay short */
+	if (2 * (r->count + 1) > r->size) {
+		registry_resize(r, 2 * r->size);
+	}
+	if (g->id >= r->next_id) {
+		r->next_id = g->id + 1;
+	}
+
+	registry_place(r, g);
+	r->count++;
+
+	g->listed = 1;
+	g->listed_next = NULL;
+	g->listed_prev = r->listed_tail;
+	if (r->listed_tail) {
+		r->listed_tail->listed_next = g;
+	} else {
+		r->listed_head = g;
+	}
+	r->listed_tail = g;
+}
+
+game_t *registry_find(registry_t *r, int id) {
+	size_t i = registry_home(r, id);
+
+	while (r->slots[i]) {
+		if (r->slots[i]->id == id) {
+			return r->slots[i];
+		}
+		i = (i + 1) & (r->size - 1);
+	}
+
+	return NULL;
+}
+
+/* Takes g off the listing, it's still reachable by id. */
+void registry_unlist(registry_t *r, game_t *g) {
+	if (!g->listed) {
+		return;
+	}
+
+	if (g->listed_prev) {
+		g->listed_prev->listed_next = g->listed_next;
+	} else {
+		r->listed_head = g->listed_next;
+	}
+	if (g->listed_next) {
+		g->listed_next->listed_prev = g->listed_prev;
+	} else {
+		r->listed_tail = g->listed_prev;
+	}
+	g->listed = 0;
+}
+
+/* Forgets about g altogether. Deletion shifts the rest of the probe
+   sequence back so that lookups never need tombstones. */
+void registry_remove(registry_t *r, game_t *g) {
+	size_t i, j, k;
+
+	registry_unlist(r, g);
+
+	for (i = registry_home(r, g->id); r->slots[i] != g; i = (i + 1) & (r->size - 1));
+	r->slots[i] = NULL;
+	r->count--;
+
+	for (j = (i + 1) & (r->size - 1); r->slots[j]; j = (j + 1) & (r->size - 1)) {
+		k = registry_home(r, r->slots[j]->id);
+		/* Move the entry back unless its home lies cyclically in (i, j] */
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			r->slots[i] = r->slots[j];
+			r->slots[j] = NULL;
+			i = j;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/* registry.h - Game registry structure and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define REGISTRY_MIN_SIZE 64
+
+/* An open-addressed (linear probing) hash table of games keyed by id, plus
+   an intrusive list of the games that are still worth listing: lobbies and
+   games in progress, in creation order. */
+typedef struct registry_s {
+	game_t **slots;
+	size_t size, count;
+	int shift;                    /* 64 - log2(size), see registry_home() */
+	int next_id;
+	game_t *listed_head, *listed_tail;
+} registry_t;
+
+void registry_init(registry_t *r);
+
+int registry_insert(registry_t *r, game_t *g);
+
+void registry_restore(registry_t *r, game_t *g);
+
+game_t *registry_find(registry_t *r, int id);
+
+void registry_unlist(registry_t *r, game_t *g);
+
+void registry_remove(registry_t *r, game_t *g);
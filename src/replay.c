@@ -0,0 +1,220 @@
+/* replay.c - Writes down every game as it is played, see replay.h. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "parse.h"
+#include "engine.h"
+#include "binary.h"
+#include "replay.h"
+
+typedef struct replay_s {
+	int fd;
+	size_t len;
+	unsigned char buf[REPLAY_BUFFER];
+} replay_t;
+
+/* Held open from the start, so that a relative --replay-dir still means
+   the same place once daemon() has changed directory */
+static int replay_dir = -1;
+
+void replay_init(const char *dir) {
+	if ((replay_dir = open(dir, O_RDONLY | O_DIRECTORY)) < 0) {
+		exit_with("open error", 1);
+	}
+}
+
+static void replay_drop(game_t *g) {
+	close(g->replay->fd);
+	free(g->replay);
+	g->replay = NULL;
+}
+
+/* A log that can't be written to is given up on, the game goes on */
+void replay_flush(game_t *g) {
+	replay_t *r = g->replay;
+	size_t done = 0;
+	ssize_t n;
+
+	if (!r) {
+		return;
+	}
+	while (done < r->len) {
+		if ((n = write(r->fd, r->buf + done, r->len - done)) < 0) {
+			replay_drop(g);
+			return;
+		}
+		done += n;
+	}
+	r->len = 0;
+}
+
+void replay_close(game_t *g) {
+	replay_flush(g);
+	if (g->replay) {
+		replay_drop(g);
+	}
+}
+
+/* Room for a record of up to size bytes at the end of the buffer, NULL if
+   the log is no more */
+static unsigned char *replay_reserve(game_t *g, size_t size) {
+	if (g->replay && g->replay->len + size > REPLAY_BUFFER) {
+		replay_flush(g);
+	}
+	return g->replay ? g->replay->buf + g->replay->len : NULL;
+}
+
+static void replay_commit(game_t *g, unsigned char *end) {
+	g->replay->len = end - g->replay->buf;
+}
+
+static unsigned char *put64(unsigned char *b, uint64_t v) {
+	b = binary_put32(b, v >> 32);
+	return binary_put32(b, v);
+}
+
+/* Starts the log of g, if there's a --replay-dir. Called right before
+   engine_start() with the same seats. */
+void replay_open(game_t *g, const int *seats, int combat_mode) {
+	char name[64];
+	unsigned char *b;
+	int i, fd, len;
+
+	if (replay_dir < 0) {
+		return;
+	}
+	sprintf(name, "%ld-%d.replay", (long) time(NULL), g->id);
+	if ((fd = openat(replay_dir, name, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+		return;
+	}
+	if (!(g->replay = malloc(sizeof(replay_t)))) {
+		exit_with("malloc error", 1);
+	}
+	g->replay->fd = fd;
+	g->replay->len = 0;
+
+	b = g->replay->buf;
+	b = binary_put32(b, REPLAY_MAGIC);
+	b = binary_put32(b, g->id);
+	*b++ = g->players;
+	*b++ = g->planets;
+	*b++ = g->turns;
+	*b++ = g->cturn;
+	*b++ = combat_mode;
+	b = put64(b, g->rng.seed);
+	for (i = 0; i < 4; i++) {
+		b = put64(b, g->rng.s[i]);
+	}
+
+	for (i = 0; i < g->planets; i++) {
+		*b++ = g->board.x[i];
+		*b++ = g->board.y[i];
+		*b++ = (unsigned char) g->board.owner[i];
+		b = binary_put32(b, g->board.ships[i]);
+		b = binary_put32(b, g->board.prod[i]);
+		b = binary_put32(b, g->board.attack[i]);
+	}
+
+	*b++ = g->players;
+	for (i = 0; i < g->players; i++) {
+		len = strlen(g->nicknames[seats[i]]);
+		*b++ = seats[i];
+		*b++ = len;
+		memcpy(b, g->nicknames[seats[i]], len);
+		b += len;
+	}
+	replay_commit(g, b);
+}
+
+void replay_order(game_t *g, int player, int from, int to, int ships) {
+	unsigned char *b;
+
+	if (!(b = replay_reserve(g, 8))) {
+		return;
+	}
+	*b++ = REPLAY_ORDER;
+	*b++ = player;
+	*b++ = from;
+	*b++ = to;
+	b = binary_put32(b, ships);
+	replay_commit(g, b);
+}
+
+/* The turn is about to end, with these seats still taken */
+void replay_turn(game_t *g, const int *seats, int nseats) {
+	unsigned char *b;
+	int i;
+
+	if (!(b = replay_reserve(g, 4 + MAX_PLAYERS))) {
+		return;
+	}
+	*b++ = REPLAY_TURN;
+	b = binary_put16(b, g->alive);
+	*b++ = nseats;
+	for (i = 0; i < nseats; i++) {
+		*b++ = seats[i];
+	}
+	replay_commit(g, b);
+}
+
+void replay_event(game_t *g, const turn_event_t *e) {
+	unsigned char *b;
+
+	if (!(b = replay_reserve(g, 10))) {
+		return;
+	}
+	*b++ = REPLAY_EVENT;
+	*b++ = e->kind;
+	*b++ = e->planet;
+	*b++ = (unsigned char) e->player;
+	*b++ = (unsigned char) e->owner;
+	*b++ = e->variant;
+	b = binary_put32(b, e->value);
+	replay_commit(g, b);
+}
+
+/* The last record there is, closes the log */
+void replay_end(game_t *g, int scores[MAX_PLAYERS + 1]) {
+	unsigned char *b;
+	int i;
+
+	if (!(b = replay_reserve(g, 4 + 4 * MAX_PLAYERS))) {
+		return;
+	}
+	*b++ = REPLAY_END;
+	b = binary_put16(b, g->alive);
+	*b++ = g->players;
+	for (i = 0; i < g->players; i++) {
+		b = binary_put32(b, scores[i + 1]);
+	}
+	replay_commit(g, b);
+	replay_close(g);
+}
@@ -0,0 +1,65 @@
+/* replay.h - A log of everything that decided how a game went. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* With --replay-dir every game that starts gets a file of its own there,
+   named after the time it started and its id. It is only ever appended
+   to, and begins with:
+
+     u32 magic, u32 game id, u8 players, u8 planets, u8 turns, u8 turn,
+     u8 combat mode, u64 seed and u64 state[4] of the rng,
+     per planet: u8 x, u8 y, i8 owner, u32 ships, u32 prod, u32 attack,
+     u8 count, then per seat: u8 id, u8 length, nickname
+
+   That is the game right before the planets are handed out, the seats in
+   the order engine_start() got them. Records follow, each a u8 type and:
+
+     ORDER   u8 player, u8 from, u8 to, u32 ships
+     TURN    u16 alive, u8 count, then per seat: u8 id
+     EVENT   u8 kind, u8 planet, i8 player, i8 owner, u8 variant, i32 value
+     END     u16 alive, u8 count, then per player: u32 score
+
+   ORDERs are the ships that actually left, as engine_send() got them.
+   Each TURN is followed by the EVENTs engine_turn() reported for it, so
+   galactic-replay can play the game again and tell whether it still comes
+   out the same. Numbers are big-endian, like in binary.h. Games brought
+   back by --restore are not logged. */
+#define REPLAY_MAGIC 0x47545231    /* "GTR1" */
+
+#define REPLAY_ORDER 1
+#define REPLAY_TURN 2
+#define REPLAY_EVENT 3
+#define REPLAY_END 4
+
+#define REPLAY_BUFFER 4096       /* written out once a turn, or when full */
+
+void replay_init(const char *dir);
+
+void replay_open(game_t *g, const int *seats, int combat_mode);
+
+void replay_order(game_t *g, int player, int from, int to, int ships);
+
+void replay_turn(game_t *g, const int *seats, int nseats);
+
+void replay_event(game_t *g, const turn_event_t *e);
+
+void replay_flush(game_t *g);
+
+void replay_end(game_t *g, int scores[MAX_PLAYERS + 1]);
+
+void replay_close(game_t *g);
@@ -0,0 +1,85 @@
+/* rng.c - Seeded random number streams for the games. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "rng.h"
+
+/* splitmix64, spreads a 64-bit value over the whole generator state */
+uint64_t rng_splitmix(uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(rng_t *r, uint64_t seed) {
+	uint64_t x = seed;
+	int i;
+	
+	r->seed = seed;
+	for (i = 0; i < 4; i++) {
+		r->s[i] = rng_splitmix(&x);
+	}
+}
+
+uint64_t rng_next(rng_t *r) {
+	uint64_t *s = r->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	
+	return result;
+}
+
+/* Non-negative, in the same range as random() */
+int rng_int(rng_t *r) {
+	return (int) (rng_next(r) >> 33);
+}
+
+/* Uniform in (0, 1), never exactly 0 so that log() is always safe */
+double rng_double(rng_t *r) {
+	return ((rng_next(r) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* Same range as rng_int(), but two numbers out of every step */
+void rng_fill(rng_t *r, int *buf, size_t n) {
+	uint64_t x;
+	size_t i;
+	
+	for (i = 0; i + 1 < n; i += 2) {
+		x = rng_next(r);
+		buf[i] = (int) (x >> 33);
+		buf[i + 1] = (int) ((x >> 1) & 0x7fffffff);
+	}
+	if (i < n) {
+		buf[i] = rng_int(r);
+	}
+}
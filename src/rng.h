@@ -0,0 +1,43 @@
+/* rng.h - Random number generator structure and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* A xoshiro256** stream. Every game owns one, so games never share state
+   and a game can be played again from its seed alone.
+
+   There is one generator on purpose, not a choice of them: replay logs
+   store s[] as it is, and the combat loop calls rng_next() too often to
+   go through a pointer. Everything random goes through the functions
+   below, so another generator means another rng.c and a new REPLAY_MAGIC.
+   Where the seeds come from is pluggable, see seed.h. */
+typedef struct rng_s {
+	uint64_t seed;
+	uint64_t s[4];
+} rng_t;
+
+uint64_t rng_splitmix(uint64_t *x);
+
+void rng_seed(rng_t *r, uint64_t seed);
+
+uint64_t rng_next(rng_t *r);
+
+int rng_int(rng_t *r);
+
+double rng_double(rng_t *r);
+
+void rng_fill(rng_t *r, int *buf, size_t n);
@@ -18,101 +18,507 @@
    You should have received a copy of the GNU General Public License
    along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <strings.h>
+#include <signal.h>
+#include <time.h>
 #include "sqlite3.h"
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
 #include "galacticd.h"
+#include "scoreboard.h"
 
 #define SCOREBOARD_DB "scoreboard.db"
+#define SCOREBOARD_TOP 100     /* how far down the high score list goes */
+#define SCOREBOARD_PAGE 10     /* rows per page */
+#define SCOREBOARD_PAGES (SCOREBOARD_TOP / SCOREBOARD_PAGE)
+#define SCOREBOARD_VERSION 1   /* schema, kept in PRAGMA user_version */
+#define RANK_SCORES 65536      /* best scores the rank tree has a slot for */
 
-static sqlite3 *db;
+/* A finished player's score on its way to the database */
+typedef struct result_s {
+	struct result_s *next;
+	char nickname[MAX_NICK_LEN + 1];
+	int game, score;
+	time_t finished;
+} result_t;
 
-static int scoreboard_list_callback(void *pp, int argc, char **argv, char **column_names) {
-	char buffer[128];
-	player_t *p = (player_t *) pp;
-	
-	sprintf(buffer, "%-15s  %-10s  %-10s\n", argv[0], argv[1], argv[2]);
-	write(p->fd, buffer, strlen(buffer));
-	
-	return 0;
-}
+/* A row of the high score list */
+typedef struct entry_s {
+	char nickname[MAX_NICK_LEN + 1];
+	int best, last;
+} entry_t;
+
+static sqlite3 *wdb;      /* the writer's */
+static sqlite3 *rdb;      /* for rank lookups, shared by the shards */
+static pthread_mutex_t rdb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How many players have each best score below RANK_SCORES, as a Fenwick
+   tree so that counting everybody above a score takes O(log RANK_SCORES)
+   however many players there are. The few best scores past the tree are
+   kept sorted in high[] instead, which grows as needed. The writer keeps
+   both in step with the database. */
+static int ranks[RANK_SCORES + 1];
+static int *high, nhigh, high_size;
+static int nplayers;
+static pthread_mutex_t rank_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The best SCOREBOARD_TOP players, best first, as of the last
+   scoreboard_add(). The database is only read once at startup. Pages are
+   rendered when first asked for and thrown away when one of their rows
+   changes. */
+static entry_t top[SCOREBOARD_TOP];
+static int ntop;
+static shared_t *pages[SCOREBOARD_PAGES];
+
+/* Every shard may add or list scores, one at a time please */
+static pthread_mutex_t top_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void scoreboard_init() {
+/* Results are pushed here by the shards without taking a lock and the
+   writer grabs the whole stack at once, newest first. */
+static result_t *pending = NULL;
+
+static int flush_ms;
+
+static void scoreboard_exec(sqlite3 *conn, const char *q) {
 	char *errmsg;
-	char *q = "CREATE TABLE IF NOT EXISTS `scores`("
-	          "`nickname` varchar(64) NOT NULL PRIMARY KEY,"
-	          "`best` integer NOT NULL,"
-	          "`last` integer NOT NULL)";
 	
-	if (sqlite3_open(SCOREBOARD_DB, &db) != SQLITE_OK) {
-		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-		exit(1);
-	}
-	if (sqlite3_exec(db, q, NULL, NULL, &errmsg) != SQLITE_OK) {
+	if (sqlite3_exec(conn, q, NULL, NULL, &errmsg) != SQLITE_OK) {
 		fprintf(stderr, "SQL error: %s\n", errmsg);
 		sqlite3_free(errmsg);
 		exit(1);
 	}
 }
 
-void scoreboard_list(player_t *p) {
-	char *errmsg;
-	char *q = "SELECT `nickname`, `best`, `last` FROM scores ORDER BY `best` DESC;";
+static sqlite3_stmt *scoreboard_prepare(sqlite3 *conn, const char *q) {
+	sqlite3_stmt *stmt;
 	
-	if (sqlite3_exec(db, q, scoreboard_list_callback, p, &errmsg) != SQLITE_OK) {
-		fprintf(stderr, "SQL error: %s\n", errmsg);
-		sqlite3_free(errmsg);
+	if (sqlite3_prepare_v2(conn, q, -1, &stmt, NULL) != SQLITE_OK) {
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(conn));
+		exit(1);
+	}
+	
+	return stmt;
+}
+
+static void scoreboard_open(sqlite3 **conn) {
+	if (sqlite3_open(SCOREBOARD_DB, conn) != SQLITE_OK) {
+		fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(*conn));
 		exit(1);
 	}
+	/* Checkpoints may hold the other connection up for a moment */
+	sqlite3_busy_timeout(*conn, 5000);
 }
 
-void scoreboard_add(char *nickname, int score) {
-	char *insert_q = "INSERT INTO `scores` (`nickname`, `best`, `last`) "
-	                 "VALUES (?, ?, ?);";
-	char *update_q = "UPDATE `scores` "
-	                 "SET `last` = ?,"
-	                 "`best` = MAX(`best`, ?)"
-	                 "WHERE `nickname` = ?;";
-	static int initialized = 0;
-	static sqlite3_stmt *insert_stmp, *update_stmp;
-	static const char *insert_stmp_tail, *update_stmp_tail;
-	int insert_rc, update_rc;
+/* How many of the scores in high[] are score or lower */
+static int high_count(int score) {
+	int lo = 0, hi = nhigh, mid;
 	
-	if (!initialized) {
-		if (sqlite3_prepare_v2(db, insert_q, 128, &insert_stmp, &insert_stmp_tail) != SQLITE_OK) {
-			fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-			exit(1);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (high[mid] <= score) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
-		if (sqlite3_prepare_v2(db, update_q, 128, &update_stmp, &update_stmp_tail) != SQLITE_OK) {
-			fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-			exit(1);
+	}
+	
+	return lo;
+}
+
+static void high_add(int score, int delta) {
+	int i = high_count(score);
+	
+	if (delta < 0) {
+		i--;                           /* the last one equal to score */
+		memmove(high + i, high + i + 1, (nhigh - i - 1) * sizeof(int));
+		nhigh--;
+		return;
+	}
+	if (nhigh == high_size) {
+		high_size = high_size ? 2 * high_size : 64;
+		if (!(high = realloc(high, high_size * sizeof(int)))) {
+			exit_with("realloc error", 1);
 		}
-		initialized = 1;
 	}
+	memmove(high + i + 1, high + i, (nhigh - i) * sizeof(int));
+	high[i] = score;
+	nhigh++;
+}
+
+static void rank_add(int score, int delta) {
+	int i;
 	
-	sqlite3_reset(insert_stmp);
-	sqlite3_reset(update_stmp);
+	if (score < 0) {
+		score = 0;
+	}
+	if (score >= RANK_SCORES) {
+		high_add(score, delta);
+		return;
+	}
+	for (i = score + 1; i <= RANK_SCORES; i += i & -i) {
+		ranks[i] += delta;
+	}
+}
+
+/* Players whose best score is higher than score */
+static int rank_above(int score) {
+	int i, n = 0;
+	
+	if (score < 0) {
+		score = 0;
+	}
+	if (score >= RANK_SCORES) {
+		return nhigh - high_count(score);
+	}
+	for (i = score + 1; i > 0; i -= i & -i) {
+		n += ranks[i];
+	}
+	
+	return nplayers - n;
+}
+
+/* Brings an older database up to date, one version at a time. Version 0
+   is the original lone `scores` table, or no database at all. */
+static void scoreboard_migrate(sqlite3 *conn) {
+	sqlite3_stmt *stmt;
+	int version;
 	
-	sqlite3_bind_text(insert_stmp, 1, nickname, -1, NULL);
-	sqlite3_bind_int(insert_stmp, 2, score);
-	sqlite3_bind_int(insert_stmp, 3, score);
-	insert_rc = sqlite3_step(insert_stmp);
+	stmt = scoreboard_prepare(conn, "PRAGMA user_version;");
+	sqlite3_step(stmt);
+	version = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+	
+	if (version > SCOREBOARD_VERSION) {
+		fprintf(stderr, "Database schema version %d is newer than ours (%d)\n",
+		        version, SCOREBOARD_VERSION);
+		exit(1);
+	}
 	
-	if (insert_rc == SQLITE_CONSTRAINT) {
-		sqlite3_bind_int(update_stmp, 1, score);
-		sqlite3_bind_int(update_stmp, 2, score);
-		sqlite3_bind_text(update_stmp, 3, nickname, -1, NULL);
-		update_rc = sqlite3_step(update_stmp);
+	if (version < 1) {
+		scoreboard_exec(conn, "BEGIN;"
+		                "CREATE TABLE IF NOT EXISTS `scores`("
+		                "`nickname` varchar(64) NOT NULL PRIMARY KEY,"
+		                "`best` integer NOT NULL,"
+		                "`last` integer NOT NULL);"
+		                "CREATE INDEX IF NOT EXISTS `scores_best` ON `scores` (`best`);"
+		                "CREATE TABLE `results`("
+		                "`id` integer PRIMARY KEY,"
+		                "`nickname` varchar(64) NOT NULL,"
+		                "`game` integer NOT NULL,"
+		                "`score` integer NOT NULL,"
+		                "`finished` integer NOT NULL);"
+		                "CREATE INDEX `results_nickname` ON `results` (`nickname`);"
+		                "PRAGMA user_version = 1;"
+		                "COMMIT;");
+	}
+}
+
+/* Opens the database. flush_interval is how long, in milliseconds, the
+   writer lets results pile up before committing them in one go. */
+void scoreboard_init(int flush_interval) {
+	char *top_q = "SELECT `nickname`, `best`, `last` FROM scores "
+	              "ORDER BY `best` DESC LIMIT ?;";
+	sqlite3_stmt *stmt;
+	entry_t *e;
+	
+	flush_ms = flush_interval;
+	
+	scoreboard_open(&wdb);
+	
+	/* With the write-ahead log a commit only has to sync the log, and rank
+	   lookups don't wait for it */
+	scoreboard_exec(wdb, "PRAGMA journal_mode=WAL;");
+	scoreboard_exec(wdb, "PRAGMA synchronous=NORMAL;");
+	scoreboard_migrate(wdb);
+	
+	scoreboard_open(&rdb);
+	
+	stmt = scoreboard_prepare(wdb, top_q);
+	sqlite3_bind_int(stmt, 1, SCOREBOARD_TOP);
+	for (ntop = 0; sqlite3_step(stmt) == SQLITE_ROW; ntop++) {
+		e = &top[ntop];
+		strncpy(e->nickname, (const char *) sqlite3_column_text(stmt, 0), MAX_NICK_LEN);
+		e->nickname[MAX_NICK_LEN] = '\0';
+		e->best = sqlite3_column_int(stmt, 1);
+		e->last = sqlite3_column_int(stmt, 2);
+	}
+	sqlite3_finalize(stmt);
+	
+	/* Only needs the index on `best` */
+	stmt = scoreboard_prepare(wdb, "SELECT `best` FROM scores;");
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		rank_add(sqlite3_column_int(stmt, 0), 1);
+		nplayers++;
+	}
+	sqlite3_finalize(stmt);
+}
+
+/* Looks nickname up, 0 if they never finished a game. Ranks count the
+   players with a better best score, so ties share a rank. Results still
+   waiting for the writer don't count yet. */
+int scoreboard_rank(const char *nickname, rank_t *r) {
+	static sqlite3_stmt *player_stmt = NULL, *games_stmt;
+	int found;
+	
+	pthread_mutex_lock(&rdb_lock);
+	if (!player_stmt) {
+		player_stmt = scoreboard_prepare(rdb, "SELECT `best`, `last` FROM scores "
+		                                      "WHERE `nickname` = ?;");
+		games_stmt = scoreboard_prepare(rdb, "SELECT COUNT(*) FROM results "
+		                                     "WHERE `nickname` = ?;");
+	}
+	
+	sqlite3_bind_text(player_stmt, 1, nickname, -1, SQLITE_STATIC);
+	if ((found = sqlite3_step(player_stmt) == SQLITE_ROW)) {
+		r->best = sqlite3_column_int(player_stmt, 0);
+		r->last = sqlite3_column_int(player_stmt, 1);
+		
+		sqlite3_bind_text(games_stmt, 1, nickname, -1, SQLITE_STATIC);
+		sqlite3_step(games_stmt);
+		r->games = sqlite3_column_int(games_stmt, 0);
+		sqlite3_reset(games_stmt);
 		
-		if (update_rc != SQLITE_DONE) {
-			fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		pthread_mutex_lock(&rank_lock);
+		r->players = nplayers;
+		r->rank = rank_above(r->best) + 1;
+		pthread_mutex_unlock(&rank_lock);
+	}
+	sqlite3_reset(player_stmt);
+	pthread_mutex_unlock(&rdb_lock);
+	
+	return found;
+}
+
+/* Throws away the rendered pages that show rows first to last. */
+static void invalidate_rows(int first, int last) {
+	int i;
+	
+	for (i = first / SCOREBOARD_PAGE; i <= last / SCOREBOARD_PAGE; i++) {
+		if (pages[i]) {
+			shared_release(pages[i]);
+			pages[i] = NULL;
+		}
+	}
+}
+
+/* Applies a result to the list the way the database will once it's
+   written. Somebody who isn't on the list only gets on it with a score
+   above the last row, which is then also their best. */
+static void update_top(const char *nickname, int score) {
+	entry_t e;
+	int i, j;
+	
+	for (i = 0; i < ntop && strcmp(top[i].nickname, nickname); i++);
+	
+	if (i < ntop) {
+		e = top[i];
+		e.last = score;
+		if (score <= e.best) {
+			top[i] = e;
+			invalidate_rows(i, i);
 			return;
 		}
-	} else if (insert_rc != SQLITE_DONE) {
-		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		e.best = score;
+	} else if (ntop < SCOREBOARD_TOP || score > top[ntop - 1].best) {
+		strcpy(e.nickname, nickname);
+		e.best = e.last = score;
+		if (ntop < SCOREBOARD_TOP) {
+			ntop++;
+		}
+		i = ntop - 1;
+	} else {
 		return;
 	}
+	
+	/* Best scores only go up, so the row only moves towards the top */
+	for (j = i; j > 0 && top[j - 1].best < e.best; j--) {
+		top[j] = top[j - 1];
+	}
+	top[j] = e;
+	invalidate_rows(j, i);
+}
+
+static shared_t *render_page(int page) {
+	static const char header[] = "\r\n"
+	                             "Player           Best Score  Last Score\r\n"
+	                             "======           ==========  ==========\r\n";
+	char buffer[128];
+	shared_t *b;
+	int i;
+	
+	b = shared_new(64 * (SCOREBOARD_PAGE + 3));
+	shared_append(b, header, sizeof(header) - 1);
+	for (i = page * SCOREBOARD_PAGE; i < ntop && i < (page + 1) * SCOREBOARD_PAGE; i++) {
+		shared_append(b, buffer, sprintf(buffer, "%-15s  %-10d  %-10d\r\n",
+		                                 top[i].nickname, top[i].best, top[i].last));
+	}
+	
+	return b;
+}
+
+/* Returns the given page of the high score list, clamped to the pages
+   there are, and sets *npages. The caller gets a reference of its own. */
+shared_t *scoreboard_page(int *page, int *npages) {
+	shared_t *b;
+	
+	pthread_mutex_lock(&top_lock);
+	*npages = ntop ? (ntop + SCOREBOARD_PAGE - 1) / SCOREBOARD_PAGE : 1;
+	if (*page >= *npages) {
+		*page = *npages - 1;
+	}
+	if (*page < 0) {
+		*page = 0;
+	}
+	if (!pages[*page]) {
+		pages[*page] = render_page(*page);
+	}
+	b = pages[*page];
+	__sync_add_and_fetch(&b->refs, 1);
+	pthread_mutex_unlock(&top_lock);
+	
+	return b;
+}
+
+/* Updates the list and queues the score for the writer thread, never
+   touches the disk. */
+void scoreboard_add(char *nickname, int game, int score) {
+	result_t *r;
+	
+	pthread_mutex_lock(&top_lock);
+	update_top(nickname, score);
+	pthread_mutex_unlock(&top_lock);
+	
+	if (!(r = malloc(sizeof(result_t)))) {
+		exit_with("malloc error", 1);
+	}
+	strncpy(r->nickname, nickname, MAX_NICK_LEN);
+	r->nickname[MAX_NICK_LEN] = '\0';
+	r->game = game;
+	r->score = score;
+	r->finished = time(NULL);
+	
+	do {
+		r->next = pending;
+	} while (!__sync_bool_compare_and_swap(&pending, r->next, r));
+}
+
+/* Writes out everything queued so far in a single transaction. */
+static void scoreboard_flush() {
+	char *best_q = "SELECT `best` FROM `scores` WHERE `nickname` = ?;";
+	char *score_q = "INSERT INTO `scores` (`nickname`, `best`, `last`) "
+	                "VALUES (?, ?, ?) "
+	                "ON CONFLICT(`nickname`) DO UPDATE SET "
+	                "`last` = excluded.`last`,"
+	                "`best` = MAX(`best`, excluded.`best`);";
+	char *result_q = "INSERT INTO `results` (`nickname`, `game`, `score`, `finished`) "
+	                 "VALUES (?, ?, ?, ?);";
+	static sqlite3_stmt *best_stmt = NULL, *score_stmt, *result_stmt;
+	result_t *r, *next, *list = NULL;
+	int best;
+	
+	r = __sync_lock_test_and_set(&pending, NULL);
+	if (!r) {
+		return;
+	}
+	
+	/* Oldest first, the last game a player finished decides `last` */
+	for (; r; r = next) {
+		next = r->next;
+		r->next = list;
+		list = r;
+	}
+	
+	if (!best_stmt) {
+		best_stmt = scoreboard_prepare(wdb, best_q);
+		score_stmt = scoreboard_prepare(wdb, score_q);
+		result_stmt = scoreboard_prepare(wdb, result_q);
+	}
+	
+	scoreboard_exec(wdb, "BEGIN;");
+	for (r = list; r; r = next) {
+		next = r->next;
+		
+		/* The old best tells which rank slot the player moves out of */
+		sqlite3_bind_text(best_stmt, 1, r->nickname, -1, SQLITE_STATIC);
+		best = sqlite3_step(best_stmt) == SQLITE_ROW ? sqlite3_column_int(best_stmt, 0) : -1;
+		sqlite3_reset(best_stmt);
+		
+		sqlite3_bind_text(score_stmt, 1, r->nickname, -1, SQLITE_STATIC);
+		sqlite3_bind_int(score_stmt, 2, r->score);
+		sqlite3_bind_int(score_stmt, 3, r->score);
+		if (sqlite3_step(score_stmt) != SQLITE_DONE) {
+			fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(wdb));
+		}
+		sqlite3_reset(score_stmt);
+		
+		sqlite3_bind_text(result_stmt, 1, r->nickname, -1, SQLITE_STATIC);
+		sqlite3_bind_int(result_stmt, 2, r->game);
+		sqlite3_bind_int(result_stmt, 3, r->score);
+		sqlite3_bind_int64(result_stmt, 4, r->finished);
+		if (sqlite3_step(result_stmt) != SQLITE_DONE) {
+			fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(wdb));
+		}
+		sqlite3_reset(result_stmt);
+		
+		pthread_mutex_lock(&rank_lock);
+		if (best < 0) {
+			rank_add(r->score, 1);
+			nplayers++;
+		} else if (r->score > best) {
+			rank_add(best, -1);
+			rank_add(r->score, 1);
+		}
+		pthread_mutex_unlock(&rank_lock);
+		
+		free(r);
+	}
+	scoreboard_exec(wdb, "COMMIT;");
+}
+
+/* Waits out the flush interval between batches. A termination signal is
+   taken here too, so that whatever is still queued reaches the disk. */
+static void *writer_main(void *arg) {
+	sigset_t *signals = (sigset_t *) arg;
+	struct timespec interval;
+	int sig;
+	
+	interval.tv_sec = flush_ms / 1000;
+	interval.tv_nsec = flush_ms % 1000 * 1000000L;
+	
+	for (;;) {
+		sig = sigtimedwait(signals, NULL, &interval);
+		scoreboard_flush();
+		if (sig > 0) {
+			exit(0);
+		}
+	}
+	
+	return NULL;
+}
+
+/* Starts the writer thread. Has to happen after daemon(), threads don't
+   survive a fork, and before any other thread so they all inherit the
+   blocked signals. */
+void scoreboard_start() {
+	static sigset_t signals;
+	pthread_t thread;
+	
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	
+	if (pthread_create(&thread, NULL, writer_main, &signals)) {
+		exit_with("pthread_create error", 0);
+	}
+	pthread_detach(thread);
 }
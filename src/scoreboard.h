@@ -17,8 +17,18 @@
    You should have received a copy of the GNU General Public License
    along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
 
-void scoreboard_init();
+/* Where a player stands, see scoreboard_rank() */
+typedef struct rank_s {
+	int rank, players;
+	int best, last, games;
+} rank_t;
 
-void scoreboard_list();
+void scoreboard_init(int flush_interval);
 
-void scoreboard_add(char *nickname, int score);
+void scoreboard_start();
+
+shared_t *scoreboard_page(int *page, int *npages);
+
+void scoreboard_add(char *nickname, int game, int score);
+
+int scoreboard_rank(const char *nickname, rank_t *r);
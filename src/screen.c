@@ -0,0 +1,182 @@
+/* screen.c - Draws the game screen, keeping whatever didn't change. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "screen.h"
+
+#define MAP_WIDTH (2 * BOARD_SIZE + 2)    /* "A . . ... | " */
+
+/* Rewrites the part of map row y to the right of the map */
+static void screen_draw_planet(screen_t *s, game_t *g, int y) {
+	board_t *b = &g->board;
+	char *r = s->rows[y] + MAP_WIDTH;
+	int i = y - 1, len;
+	
+	if (b->owner[i] != NOBODY) {
+		len = snprintf(r, SCREEN_ROW_SIZE - MAP_WIDTH, "%-6c  %-5d  %-4d  %-7d  %s",
+		               'A'+i, b->ships[i], b->prod[i], b->attack[i],
+		               g->nicknames[(int) b->owner[i]]);
+	} else {
+		len = snprintf(r, SCREEN_ROW_SIZE - MAP_WIDTH, "%c", 'A'+i);
+	}
+	if (len >= SCREEN_ROW_SIZE - MAP_WIDTH) {
+		len = SCREEN_ROW_SIZE - MAP_WIDTH - 1;
+	}
+	s->lens[y] = MAP_WIDTH + len;
+	s->row_gen[y] = s->gen;
+	
+	s->ships[i] = b->ships[i];
+	s->prod[i] = b->prod[i];
+	s->attack[i] = b->attack[i];
+	s->owner[i] = b->owner[i];
+}
+
+static void screen_draw_footer(screen_t *s, game_t *g) {
+	char *r = s->rows[BOARD_SIZE] + 2 * BOARD_SIZE;
+	
+	if (g->cturn <= g->turns) {
+		sprintf(r, "+-[Galactic Turtle, Turn #%2d/%2d]-", g->cturn, g->turns);
+	} else {
+		sprintf(r, "+-[Galactic Turtle, Game Over :o ]-");
+	}
+	s->lens[BOARD_SIZE] = 2 * BOARD_SIZE + strlen(r);
+	s->row_gen[BOARD_SIZE] = s->gen;
+	s->turn = g->cturn;
+}
+
+/* The map never changes during a game, it's drawn here once */
+screen_t *screen_new(game_t *g) {
+	screen_t *s;
+	int i, x, y;
+	
+	if (!(s = calloc(1, sizeof(screen_t)))) {
+		exit_with("calloc error", 1);
+	}
+	s->gen = 1;
+	
+	for (y = 0; y < BOARD_SIZE; y++) {
+		for (x = 0; x < BOARD_SIZE; x++) {
+			memcpy(s->rows[y] + 2 * x, ". ", 2);
+		}
+		memcpy(s->rows[y] + 2 * BOARD_SIZE, "| ", 2);
+		s->lens[y] = MAP_WIDTH;
+		s->row_gen[y] = s->gen;
+	}
+	for (i = 0; i < g->planets; i++) {
+		s->rows[g->board.y[i]][2 * g->board.x[i]] = 'A' + i;
+	}
+	strcpy(s->rows[0] + MAP_WIDTH, "Planet  Ships  Prod  Attack%  Owner");
+	s->lens[0] += strlen(s->rows[0] + MAP_WIDTH);
+	
+	for (y = 1; y <= g->planets; y++) {
+		screen_draw_planet(s, g, y);
+	}
+	
+	for (x = 0; x < BOARD_SIZE; x++) {
+		memcpy(s->rows[BOARD_SIZE] + 2 * x, "--", 2);
+	}
+	screen_draw_footer(s, g);
+	
+	return s;
+}
+
+/* Redraws the rows of the planets that changed since the last update */
+void screen_update(screen_t *s, game_t *g) {
+	board_t *b = &g->board;
+	int i, changed = 0;
+	
+	for (i = 0; i < g->planets; i++) {
+		if (b->ships[i] != s->ships[i] || b->prod[i] != s->prod[i] ||
+		    b->attack[i] != s->attack[i] || b->owner[i] != s->owner[i]) {
+			if (!changed++) {
+				s->gen++;
+			}
+			screen_draw_planet(s, g, i + 1);
+		}
+	}
+	
+	if (g->cturn != s->turn) {
+		if (!changed++) {
+			s->gen++;
+		}
+		screen_draw_footer(s, g);
+	}
+}
+
+const char *screen_text(screen_t *s, size_t *len) {
+	char *t = s->text;
+	int y;
+	
+	if (s->text_gen != s->gen) {
+		for (y = 0; y < SCREEN_ROWS; y++) {
+			memcpy(t, s->rows[y], s->lens[y]);
+			t += s->lens[y];
+			*t++ = '\r';
+			*t++ = '\n';
+		}
+		s->text_len = t - s->text;
+		s->text_gen = s->gen;
+	}
+	
+	*len = s->text_len;
+	return s->text;
+}
+
+/* For terminals that understand ANSI escapes. A client that has seen
+   nothing yet (since is 0) gets the whole screen at the top, with a
+   scrolling region below it for everything else. After that only the rows
+   changed since gen `since' are redrawn in place, leaving the cursor where
+   it was. Returns the length of what was written to buf, which must hold
+   SCREEN_ANSI_SIZE bytes. */
+size_t screen_ansi(screen_t *s, unsigned int since, char *buf) {
+	const char *text;
+	char *b = buf;
+	size_t len;
+	int y;
+	
+	if (!since) {
+		text = screen_text(s, &len);
+		b += sprintf(b, "\033[r\033[2J\033[H");
+		memcpy(b, text, len);
+		b += len;
+		b += sprintf(b, "\033[%dr\033[%d;1H", SCREEN_ROWS + 2, SCREEN_ROWS + 2);
+		return b - buf;
+	}
+	
+	b += sprintf(b, "\0337");
+	for (y = 0; y < SCREEN_ROWS; y++) {
+		if (s->row_gen[y] > since) {
+			b += sprintf(b, "\033[%d;1H", y + 1);
+			memcpy(b, s->rows[y], s->lens[y]);
+			b += s->lens[y];
+			b += sprintf(b, "\033[K");
+		}
+	}
+	b += sprintf(b, "\0338");
+	
+	return b - buf;
+}
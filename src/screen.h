@@ -0,0 +1,51 @@
+/* screen.h - Game screen structure and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define SCREEN_ROWS (BOARD_SIZE + 1)    /* map and planet table, then the footer */
+#define SCREEN_ROW_SIZE 96
+#define SCREEN_TEXT_SIZE (SCREEN_ROWS * (SCREEN_ROW_SIZE + 2))
+#define SCREEN_ANSI_SIZE (SCREEN_TEXT_SIZE + SCREEN_ROWS * 16 + 64)
+
+/* The game screen as last drawn, one row per line. Every update bumps gen
+   and tags the rows it changed with it, so clients in ANSI mode only get
+   the rows that are newer than what they have. */
+typedef struct screen_s {
+	char rows[SCREEN_ROWS][SCREEN_ROW_SIZE];    /* without the line ending */
+	int lens[SCREEN_ROWS];
+	unsigned int row_gen[SCREEN_ROWS];
+	unsigned int gen;
+	
+	/* What the planet rows and the footer currently say */
+	int ships[MAX_PLANETS], prod[MAX_PLANETS], attack[MAX_PLANETS];
+	int owner[MAX_PLANETS];
+	int turn;
+	
+	/* The whole screen as plain text, put together on demand */
+	char text[SCREEN_TEXT_SIZE];
+	size_t text_len;
+	unsigned int text_gen;
+} screen_t;
+
+screen_t *screen_new(game_t *g);
+
+void screen_update(screen_t *s, game_t *g);
+
+const char *screen_text(screen_t *s, size_t *len);
+
+size_t screen_ansi(screen_t *s, unsigned int since, char *buf);
@@ -0,0 +1,73 @@
+/* seed.c - Where the rng streams of new games get their seeds from. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "common.h"
+#include "rng.h"
+#include "seed.h"
+#include "QRBG/QRBG_wrapper.h"
+
+static int seed_source = RNG_SEED_URANDOM;
+static uint64_t seed_base, seed_count;
+static pthread_mutex_t seed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void rng_set_seed_source(int source, uint64_t base) {
+	seed_source = source;
+	seed_base = base;
+}
+
+/* Picks the seed for a new stream. Safe to call from any shard. */
+uint64_t rng_new_seed() {
+	uint64_t seed;
+	size_t n = 0;
+	ssize_t r;
+	int fd;
+	
+	switch (seed_source) {
+		case RNG_SEED_QRBG:
+			seed = (uint64_t) (unsigned int) QRBG_get_int() << 32;
+			seed |= (unsigned int) QRBG_get_int();
+			break;
+		case RNG_SEED_FIXED:
+			pthread_mutex_lock(&seed_lock);
+			seed = seed_base + seed_count++;
+			pthread_mutex_unlock(&seed_lock);
+			seed = rng_splitmix(&seed);
+			break;
+		default:
+			if ((fd = open("/dev/urandom", O_RDONLY)) < 0) {
+				exit_with("open error", 1);
+			}
+			while (n < sizeof(seed)) {
+				if ((r = read(fd, (char *) &seed + n, sizeof(seed) - n)) <= 0) {
+					exit_with("read error", 1);
+				}
+				n += r;
+			}
+			close(fd);
+			break;
+	}
+	
+	return seed;
+}
@@ -0,0 +1,95 @@
+/* shard.c - Hands players over between worker threads. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "event.h"
+#include "shard.h"
+
+void shard_init(shard_t *s, int id) {
+	s->id = id;
+	s->listenfd = s->binlistenfd = -1;
+	s->inbox = s->inbox_tail = NULL;
+	s->dirty = NULL;
+	s->loop = event_loop_new();
+	wheel_init(&s->wheel);
+
+	if (pipe(s->wakefd) < 0) {
+		exit_with("pipe error", 1);
+	}
+	fcntl(s->wakefd[0], F_SETFL, fcntl(s->wakefd[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(s->wakefd[1], F_SETFL, fcntl(s->wakefd[1], F_GETFL, 0) | O_NONBLOCK);
+
+	if (pthread_mutex_init(&s->inbox_lock, NULL)) {
+		exit_with("pthread_mutex_init error", 0);
+	}
+
+	if (event_add(s->loop, s->wakefd[0], EV_READ, s->wakefd) < 0) {
+		exit_with("event_add error", 1);
+	}
+}
+
+/* Queues a player for adoption by shard s and wakes up its thread. The
+   caller must have removed the player from its own event loop already. */
+void shard_post(shard_t *s, player_t *p) {
+	int was_empty;
+
+	p->next = NULL;
+
+	pthread_mutex_lock(&s->inbox_lock);
+	was_empty = !s->inbox;
+	if (s->inbox_tail) {
+		s->inbox_tail->next = p;
+	} else {
+		s->inbox = p;
+	}
+	s->inbox_tail = p;
+	pthread_mutex_unlock(&s->inbox_lock);
+
+	/* A full pipe is fine, the shard is going to wake up anyway */
+	if (was_empty) {
+		while (write(s->wakefd[1], "", 1) < 0 && errno == EINTR);
+	}
+}
+
+/* Returns every player waiting in the inbox, in arrival order. */
+player_t *shard_take_inbox(shard_t *s) {
+	char buffer[64];
+	ssize_t n;
+	player_t *list;
+
+	while ((n = read(s->wakefd[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR));
+
+	pthread_mutex_lock(&s->inbox_lock);
+	list = s->inbox;
+	s->inbox = s->inbox_tail = NULL;
+	pthread_mutex_unlock(&s->inbox_lock);
+
+	return list;
+}
@@ -0,0 +1,41 @@
+/* shard.h - Structures and function prototypes for the worker threads. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define MAX_SHARDS 64
+
+/* Every shard runs its own event loop on its own thread and owns the games
+   pinned to it. Players are moved between shards through the inbox. */
+typedef struct shard_s {
+	int id;
+	pthread_t thread;
+	event_loop_t *loop;
+	int listenfd;
+	int binlistenfd;              /* binary protocol, see binary.h */
+	int wakefd[2];
+	pthread_mutex_t inbox_lock;
+	player_t *inbox, *inbox_tail;
+	player_t *dirty;              /* players with output to flush */
+	wheel_t wheel;                /* timeouts of our players and games */
+} shard_t;
+
+void shard_init(shard_t *s, int id);
+
+void shard_post(shard_t *s, player_t *p);
+
+player_t *shard_take_inbox(shard_t *s);
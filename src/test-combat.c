@@ -0,0 +1,126 @@
+/* test-combat.c - Checks that combat_sampled() fights the same battles as
+   combat_per_ship(), statistically speaking. Part of make check. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include "rng.h"
+#include "combat.h"
+
+/* The seeds are fixed, so this either always passes or always fails; the
+   tolerance is wide enough that a correct engine never comes close. */
+#define TOLERANCE 5.0           /* standard errors */
+
+typedef struct scenario_s {
+	int attackers, defenders, attack, defense, battles;
+} scenario_t;
+
+/* Small and large fleets, close and lopsided fights, ratios at the ends
+   of the range and the untouchable cases */
+static const scenario_t scenarios[] = {
+	{ 1, 1, 40, 40, 20000 },
+	{ 5, 3, 40, 55, 20000 },
+	{ 20, 20, 40, 40, 20000 },
+	{ 17, 200, 60, 10, 20000 },
+	{ 100, 60, 30, 70, 20000 },
+	{ 500, 480, 40, 45, 10000 },
+	{ 3000, 2900, 60, 50, 2000 },
+	{ 200, 10, 5, 95, 20000 },
+	{ 50, 50, 99, 0, 20000 },
+	{ 50, 50, 0, 99, 20000 },
+	{ 40, 400, 70, 20, 20000 },
+	{ 100, 100, 100, 50, 1000 },
+	{ 100, 100, 50, 100, 1000 },
+	{ 100, 100, 100, 100, 1000 }
+};
+
+/* Moments of the battles' margin: surviving attackers, or minus the
+   surviving defenders */
+typedef struct moments_s {
+	double mean, var, m4, wins;
+} moments_t;
+
+static void fight(const scenario_t *s, int mode, uint64_t seed, moments_t *m) {
+	rng_t rng;
+	double x, sum = 0, sum2 = 0, sum4 = 0;
+	int i, a, b;
+	static double margins[20000];
+
+	rng_seed(&rng, seed);
+	m->wins = 0;
+	for (i = 0; i < s->battles; i++) {
+		a = s->attackers;
+		b = s->defenders;
+		if (mode == COMBAT_SAMPLED) {
+			combat_sampled(&a, &b, s->attack, s->defense, &rng);
+		} else {
+			combat_per_ship(&a, &b, s->attack, s->defense, &rng);
+		}
+		margins[i] = a - b;
+		sum += a - b;
+		m->wins += a > 0;
+	}
+
+	m->mean = sum / s->battles;
+	for (i = 0; i < s->battles; i++) {
+		x = margins[i] - m->mean;
+		sum2 += x * x;
+		sum4 += x * x * x * x;
+	}
+	m->var = sum2 / (s->battles - 1);
+	m->m4 = sum4 / s->battles;
+	m->wins /= s->battles;
+}
+
+/* Whether the difference is within TOLERANCE of its standard error. Both
+   zero is a match, whatever the error. */
+static int close_enough(double x, double y, double se) {
+	return x == y || fabs(x - y) <= TOLERANCE * se;
+}
+
+int main() {
+	const scenario_t *s;
+	moments_t p, q;
+	double n, se_mean, se_var, se_wins;
+	int i, ok, failed = 0;
+
+	for (i = 0; i < (int) (sizeof(scenarios) / sizeof(scenarios[0])); i++) {
+		s = &scenarios[i];
+		n = s->battles;
+		fight(s, COMBAT_PER_SHIP, 1000 + i, &p);
+		fight(s, COMBAT_SAMPLED, 2000 + i, &q);
+
+		/* The variance of a sample variance is (m4 - var^2) / n */
+		se_mean = sqrt(p.var / n + q.var / n);
+		se_var = sqrt(fabs(p.m4 - p.var * p.var) / n + fabs(q.m4 - q.var * q.var) / n);
+		se_wins = sqrt(p.wins * (1 - p.wins) / n + q.wins * (1 - q.wins) / n);
+
+		ok = close_enough(p.mean, q.mean, se_mean) &&
+		     close_enough(p.var, q.var, se_var) &&
+		     close_enough(p.wins, q.wins, se_wins);
+		printf("%s: %d vs %d at %d/%d: mean %.2f/%.2f, variance %.1f/%.1f,"
+		       " wins %.4f/%.4f\n", ok ? "ok" : "FAIL", s->attackers,
+		       s->defenders, s->attack, s->defense, p.mean, q.mean, p.var,
+		       q.var, p.wins, q.wins);
+		failed += !ok;
+	}
+
+	return failed ? 1 : 0;
+}
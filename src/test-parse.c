@@ -0,0 +1,299 @@
+/* test-parse.c - Feeds parse_order() and parse_nickname() good and bad
+   input. Part of make check; with -b it times parse_order() against the
+   regex it replaced instead. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <regex.h>
+#include "common.h"
+#include "outq.h"
+#include "rng.h"
+#include "wheel.h"
+#include "galacticd.h"
+#include "moves.h"
+#include "parse.h"
+#include "engine.h"
+
+#define BENCH_LINES 200000
+
+/* A line and the orders parse_order() should read off it, one after the
+   other. Orders are "from to n unit", and the list ends with what the
+   call after the last order returns: 0 for the end of the line, -1 for
+   something that makes no sense. */
+typedef struct order_case_s {
+	const char *line;
+	int norders;
+	int orders[3][4];
+	int last;
+} order_case_t;
+
+static const order_case_t order_cases[] = {
+	{ "a b 10", 1, { { 0, 1, 10, ORDER_SHIPS } }, 0 },
+	{ "  C\tD   7  ", 1, { { 2, 3, 7, ORDER_SHIPS } }, 0 },
+	{ "a b 50%", 1, { { 0, 1, 50, ORDER_PERCENT } }, 0 },
+	{ "a b all", 1, { { 0, 1, 100, ORDER_PERCENT } }, 0 },
+	{ "a b ALL", 1, { { 0, 1, 100, ORDER_PERCENT } }, 0 },
+	{ "a b 150%", 1, { { 0, 1, 150, ORDER_PERCENT } }, 0 },    /* engine says no */
+
+	/* Counts too big for an int are clamped, not wrapped around */
+	{ "a b 1000000000", 1, { { 0, 1, 1000000000, ORDER_SHIPS } }, 0 },
+	{ "a b 4294967297", 1, { { 0, 1, 1000000000, ORDER_SHIPS } }, 0 },
+	{ "a b 99999999999999999999999999", 1, { { 0, 1, 1000000000, ORDER_SHIPS } }, 0 },
+	{ "a b 99999999999999999999%", 1, { { 0, 1, 1000000000, ORDER_PERCENT } }, 0 },
+
+	/* Bulk orders, empty ones in between are skipped */
+	{ "a b 1; c d 2", 2, { { 0, 1, 1, ORDER_SHIPS }, { 2, 3, 2, ORDER_SHIPS } }, 0 },
+	{ "a b 1;; ;c d 2;", 2, { { 0, 1, 1, ORDER_SHIPS }, { 2, 3, 2, ORDER_SHIPS } }, 0 },
+	{ ";a b 1", 1, { { 0, 1, 1, ORDER_SHIPS } }, 0 },
+	{ "a b 1;c d 2;e f all", 3, { { 0, 1, 1, ORDER_SHIPS }, { 2, 3, 2, ORDER_SHIPS },
+	                              { 4, 5, 100, ORDER_PERCENT } }, 0 },
+	{ "a b 1; x", 1, { { 0, 1, 1, ORDER_SHIPS } }, -1 },
+	{ "a b 1; c d 0; e f 1", 1, { { 0, 1, 1, ORDER_SHIPS } }, -1 },
+	{ "", 0, { { 0 } }, 0 },
+	{ "   ", 0, { { 0 } }, 0 },
+	{ ";;; ;", 0, { { 0 } }, 0 },
+
+	/* Malformed counts */
+	{ "a b %", 0, { { 0 } }, -1 },
+	{ "a b 10%%", 0, { { 0 } }, -1 },
+	{ "a b 10 %", 0, { { 0 } }, -1 },
+	{ "a b all%", 0, { { 0 } }, -1 },
+	{ "a b 0", 0, { { 0 } }, -1 },
+	{ "a b 010", 0, { { 0 } }, -1 },
+	{ "a b -5", 0, { { 0 } }, -1 },
+	{ "a b 1e3", 0, { { 0 } }, -1 },
+	{ "a b", 0, { { 0 } }, -1 },
+	{ "a b ", 0, { { 0 } }, -1 },
+
+	/* Malformed planets, only ASCII letters will do */
+	{ "[ b 1", 0, { { 0 } }, -1 },
+	{ "a ` 1", 0, { { 0 } }, -1 },
+	{ "1 b 1", 0, { { 0 } }, -1 },
+	{ "ab c 1", 0, { { 0 } }, -1 },
+	{ "a bc 1", 0, { { 0 } }, -1 },
+	{ "a 1", 0, { { 0 } }, -1 },
+	{ "a b 1 extra", 0, { { 0 } }, -1 },
+	{ "pass", 0, { { 0 } }, -1 }
+};
+
+/* Well-formed orders that don't fit a 3 planet board. engine_order()
+   returns minus the error do_move() reports. */
+typedef struct range_case_s {
+	const char *line;
+	int error;
+} range_case_t;
+
+static const range_case_t range_cases[] = {
+	{ "a b 5", 0 },
+	{ "d a 5", 1 },         /* no such source planet */
+	{ "z a 5", 1 },
+	{ "b a 5", 2 },         /* somebody else's */
+	{ "a d 5", 3 },         /* no such target planet */
+	{ "a a 5", 3 },
+	{ "a b 21", 4 },        /* more than there are */
+	{ "a b 101%", 4 },
+	{ "a b 4%", 4 },        /* rounds down to no ships at all */
+	{ "a b 1000000000", 4 }
+};
+
+typedef struct nickname_case_s {
+	const char *nickname;
+	int ok;
+} nickname_case_t;
+
+static const nickname_case_t nickname_cases[] = {
+	{ "bob", 1 },
+	{ "Bob 2", 1 },
+	{ "", 0 },
+	{ "a_b", 0 },
+	{ "[x]", 0 },
+	{ "tab\there", 0 },
+	{ "caf\xc3\xa9", 0 }
+};
+
+static int check_orders(const order_case_t *c) {
+	const char *line = c->line;
+	order_t o;
+	int i, r;
+
+	for (i = 0; i < c->norders; i++) {
+		if ((r = parse_order(&line, &o)) != 1) {
+			printf("FAIL: \"%s\": order %d returned %d\n", c->line, i + 1, r);
+			return 0;
+		}
+		if (o.from != c->orders[i][0] || o.to != c->orders[i][1] ||
+		    o.n != c->orders[i][2] || o.unit != c->orders[i][3]) {
+			printf("FAIL: \"%s\": order %d read as %d %d %d %d\n", c->line, i + 1,
+			       o.from, o.to, o.n, o.unit);
+			return 0;
+		}
+	}
+	if ((r = parse_order(&line, &o)) != c->last) {
+		printf("FAIL: \"%s\": returned %d after %d orders, not %d\n", c->line, r,
+		       c->norders, c->last);
+		return 0;
+	}
+	return 1;
+}
+
+static int check_range(const range_case_t *c) {
+	game_t *g;
+	const char *line = c->line;
+	order_t o;
+	int r, i, ok;
+
+	if (!(g = calloc(1, sizeof(game_t)))) {
+		return 0;
+	}
+	g->players = 2;
+	g->planets = 3;
+	g->turns = g->cturn = 1;
+	for (i = 0; i < 3; i++) {
+		g->board.x[i] = i;
+		g->board.owner[i] = i < 2 ? i : NOBODY;
+		g->board.ships[i] = 20;
+		g->board.attack[i] = 40;
+	}
+
+	r = parse_order(&line, &o) == 1 ? engine_order(g, 0, &o) : -99;
+	ok = c->error ? r == -c->error : r > 0;
+	if (!ok) {
+		printf("FAIL: \"%s\" on a 3 planet board: %d\n", c->line, r);
+	}
+
+	for (i = 0; i < MOVE_SLOTS; i++) {
+		moves_free(&g->moves[i]);
+	}
+	free(g);
+	return ok;
+}
+
+/* The order regex and its use as they were before parse.c, for -b */
+static int regex_order(regex_t *re, char *line, int *from, int *to, int *n) {
+	regmatch_t m[4];
+
+	if (regexec(re, line, 4, m, 0)) {
+		return 0;
+	}
+	line[m[1].rm_eo] = '\0';
+	*from = toupper(line[m[1].rm_so]) - 'A';
+	line[m[2].rm_eo] = '\0';
+	*to = toupper(line[m[2].rm_so]) - 'A';
+	line[m[3].rm_eo] = '\0';
+	*n = atoi(&line[m[3].rm_so]);
+	return 1;
+}
+
+static double elapsed(struct timespec *t0) {
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1e9 + (t1.tv_nsec - t0->tv_nsec);
+}
+
+/* Lines shaped like what the seeded test game sends, with a "pass" or a
+   malformed one now and then. Both parsers have to agree on every line. */
+static int bench() {
+	static char lines[BENCH_LINES][16];
+	char buf[16];
+	const char *line;
+	regex_t re;
+	rng_t rng;
+	order_t o;
+	struct timespec t0;
+	double ns_regex, ns_parse;
+	int i, k, from, to, n, ok1, ok2, accepted = 0;
+
+	if (regcomp(&re, "^([A-z])[[:space:]]+([A-z])[[:space:]]+([1-9][0-9]*)$", REG_EXTENDED)) {
+		return 1;
+	}
+	rng_seed(&rng, 1);
+	for (i = 0; i < BENCH_LINES; i++) {
+		k = rng_int(&rng) % 20;
+		if (k == 0) {
+			strcpy(lines[i], "pass");
+		} else if (k == 1) {
+			sprintf(lines[i], "%c %c x", 'A' + rng_int(&rng) % 8, 'A' + rng_int(&rng) % 8);
+		} else {
+			sprintf(lines[i], "%c %c %d", 'A' + rng_int(&rng) % 8, 'A' + rng_int(&rng) % 8,
+			        1 + rng_int(&rng) % 500);
+		}
+	}
+
+	for (i = 0; i < BENCH_LINES; i++) {
+		strcpy(buf, lines[i]);
+		ok1 = regex_order(&re, buf, &from, &to, &n);
+		line = lines[i];
+		ok2 = parse_order(&line, &o) == 1;
+		if (ok1 != ok2 || (ok1 && (from != o.from || to != o.to || n != o.n))) {
+			printf("FAIL: the parsers disagree on \"%s\"\n", lines[i]);
+			return 1;
+		}
+		accepted += ok1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0, k = 0; i < BENCH_LINES; i++) {
+		strcpy(buf, lines[i]);
+		k += regex_order(&re, buf, &from, &to, &n);
+	}
+	ns_regex = elapsed(&t0) / BENCH_LINES;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0, k = 0; i < BENCH_LINES; i++) {
+		strcpy(buf, lines[i]);
+		line = buf;
+		k += parse_order(&line, &o) == 1;
+	}
+	ns_parse = elapsed(&t0) / BENCH_LINES;
+
+	printf("%d lines, %d orders: regexec() %.0f ns/line, parse_order() %.0f ns/line\n",
+	       BENCH_LINES, accepted, ns_regex, ns_parse);
+	regfree(&re);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int i, failed = 0, total = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		return bench();
+	}
+
+	for (i = 0; i < (int) (sizeof(order_cases) / sizeof(order_cases[0])); i++, total++) {
+		failed += !check_orders(&order_cases[i]);
+	}
+	for (i = 0; i < (int) (sizeof(range_cases) / sizeof(range_cases[0])); i++, total++) {
+		failed += !check_range(&range_cases[i]);
+	}
+	for (i = 0; i < (int) (sizeof(nickname_cases) / sizeof(nickname_cases[0])); i++, total++) {
+		if (parse_nickname(nickname_cases[i].nickname) != nickname_cases[i].ok) {
+			printf("FAIL: nickname \"%s\"\n", nickname_cases[i].nickname);
+			failed++;
+		}
+	}
+
+	printf("%d of %d cases passed\n", total - failed, total);
+	return failed ? 1 : 0;
+}
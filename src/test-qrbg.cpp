@@ -0,0 +1,180 @@
+/* test-qrbg.cpp - Runs the QRBG pools against a fake service on loopback
+   that counts instead of being random, so that every int can be checked
+   for coming out in order across pool swaps. One refill is cut off
+   halfway, which the refill thread has to retry. Part of make check. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+extern "C" {
+#include "QRBG/QRBG_wrapper.h"
+}
+
+#define USER "turtle"
+#define PASS "secret"
+#define TAKE (5 * 256 * 1024)     /* five pools' worth */
+#define DROP_AT 3                 /* the second refill after the first pool */
+#define DELAY 100000              /* us, slower than the pools are drained */
+
+/* What the service has seen so far, under lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int next_int;
+static int requests, drops, bad_logins;
+
+static int read_all(int fd, unsigned char *buf, size_t len) {
+	ssize_t r;
+
+	while (len) {
+		if ((r = read(fd, buf, len)) <= 0) {
+			return 0;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+	ssize_t r;
+
+	while (len) {
+		if ((r = write(fd, buf, len)) <= 0) {
+			return 0;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 1;
+}
+
+/* Answers a GET_DATA_AUTH_PLAIN request, see QRBG.cpp. Returns 0 once the
+   connection should be closed. */
+static int serve_request(int fd) {
+	unsigned char head[6], body[256], *data;
+	unsigned int size, want, i, n, first;
+	int drop;
+
+	if (!read_all(fd, head, 3)) {
+		return 0;
+	}
+	size = (head[1] << 8) | head[2];
+	if (size < 6 || size > sizeof(body) || !read_all(fd, body, size)) {
+		return 0;
+	}
+	want = ((unsigned int) body[size - 4] << 24) | (body[size - 3] << 16) |
+	       (body[size - 2] << 8) | body[size - 1];
+
+	pthread_mutex_lock(&lock);
+	if (body[0] != strlen(USER) || memcmp(body + 1, USER, body[0]) ||
+	    body[1 + body[0]] != strlen(PASS) || memcmp(body + 2 + body[0], PASS, strlen(PASS))) {
+		bad_logins++;
+	}
+	drop = ++requests == DROP_AT;
+	drops += drop;
+	first = next_int;
+	if (!drop) {
+		next_int += want / sizeof(int);
+	}
+	pthread_mutex_unlock(&lock);
+
+	usleep(DELAY);
+	if (!(data = (unsigned char *) malloc(want))) {
+		return 0;
+	}
+	for (i = 0, n = first; i + sizeof(int) <= want; i += sizeof(int), n++) {
+		memcpy(data + i, &n, sizeof(int));
+	}
+
+	head[0] = 0;                  /* OK */
+	head[1] = 0;
+	head[2] = want >> 24;
+	head[3] = want >> 16;
+	head[4] = want >> 8;
+	head[5] = want;
+
+	/* A dropped request gets half its data before the connection goes,
+	   and hands out the same ints again when it's retried */
+	if (!write_all(fd, head, 6) || !write_all(fd, data, drop ? want / 2 : want) || drop) {
+		free(data);
+		return 0;
+	}
+	free(data);
+	return 1;
+}
+
+static void *serve_main(void *arg) {
+	int lfd = *(int *) arg, fd;
+
+	for (;;) {
+		if ((fd = accept(lfd, NULL, NULL)) < 0) {
+			continue;
+		}
+		while (serve_request(fd));
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int main() {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	pthread_t thread;
+	static int lfd;
+	int i, r, ok;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0 ||
+	    getsockname(lfd, (struct sockaddr *) &addr, &len) < 0) {
+		perror("socket");
+		return 1;
+	}
+	if (pthread_create(&thread, NULL, serve_main, &lfd)) {
+		return 1;
+	}
+
+	/* The first pool is filled before QRBG_start(), the rest by the refill
+	   thread while we read */
+	QRBG_connect("127.0.0.1", ntohs(addr.sin_port), USER, PASS);
+	QRBG_start();
+	for (i = 0; i < TAKE; i++) {
+		if ((r = QRBG_get_int()) != i) {
+			printf("FAIL: int %d came out as %d\n", i, r);
+			return 1;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	ok = !bad_logins && drops == 1 && requests > TAKE / (256 * 1024);
+	printf("%s: %d ints in order, %d requests, %d dropped, %d bad logins\n",
+	       ok ? "ok" : "FAIL", TAKE, requests, drops, bad_logins);
+	pthread_mutex_unlock(&lock);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+/* wheel.c - Keeps track of timeouts. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+/* Milliseconds since some point in the past, never goes backwards */
+uint64_t wheel_clock() {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void wheel_init(wheel_t *w) {
+	int i, j;
+	
+	w->now = wheel_clock() / WHEEL_TICK;
+	w->count = 0;
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			w->slots[i][j] = NULL;
+		}
+	}
+}
+
+void timeout_init(timeout_t *t, void (*fire)(void *data), void *data) {
+	t->next = NULL;
+	t->pprev = NULL;
+	t->fire = fire;
+	t->data = data;
+}
+
+static void timeout_link(timeout_t **head, timeout_t *t) {
+	if ((t->next = *head)) {
+		t->next->pprev = &t->next;
+	}
+	*head = t;
+	t->pprev = head;
+}
+
+static void timeout_unlink(timeout_t *t) {
+	if ((*t->pprev = t->next)) {
+		t->next->pprev = t->pprev;
+	}
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/* Files t under the slot its expiry falls in, as seen from w->now */
+static void wheel_place(wheel_t *w, timeout_t *t) {
+	uint64_t delta = t->expires - w->now;
+	int level;
+	
+	for (level = 0; level < WHEEL_LEVELS - 1 &&
+	     delta >= (uint64_t) 1 << (WHEEL_BITS * (level + 1)); level++);
+	if (delta >= (uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) {
+		t->expires = w->now + ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	}
+	timeout_link(&w->slots[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK], t);
+}
+
+/* (Re)arms t to fire in ms milliseconds, at the earliest on the next tick */
+void wheel_add(wheel_t *w, timeout_t *t, unsigned int ms) {
+	uint64_t ticks = (ms + WHEEL_TICK - 1) / WHEEL_TICK;
+	
+	if (t->pprev) {
+		timeout_unlink(t);
+	} else {
+		w->count++;
+	}
+	t->expires = w->now + (ticks ? ticks : 1);
+	wheel_place(w, t);
+}
+
+void wheel_cancel(wheel_t *w, timeout_t *t) {
+	if (t->pprev) {
+		timeout_unlink(t);
+		w->count--;
+	}
+}
+
+/* How long the event loop may sleep, in milliseconds. Level 0 is looked
+   through up to the end of its lap, which is when the levels above might
+   bring something down. */
+int wheel_timeout(wheel_t *w) {
+	uint64_t now = wheel_clock(), next, lap;
+	
+	if (!w->count) {
+		return -1;
+	}
+	
+	lap = ((w->now >> WHEEL_BITS) + 1) << WHEEL_BITS;
+	for (next = w->now + 1; next < lap && !w->slots[0][next & WHEEL_MASK]; next++);
+	next *= WHEEL_TICK;
+	
+	return next > now ? (int) (next - now) : 0;
+}
+
+/* Moves the timeouts of the current slot of level down into the levels
+   below, now that they're close enough. */
+static void wheel_cascade(wheel_t *w, int level) {
+	timeout_t *t, *list = w->slots[level][(w->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	
+	w->slots[level][(w->now >> (WHEEL_BITS * level)) & WHEEL_MASK] = NULL;
+	while ((t = list)) {
+		list = t->next;
+		t->next = NULL;
+		wheel_place(w, t);
+	}
+}
+
+/* Fires everything that's due. A timeout may add or cancel any other one
+   from its callback, itself included. */
+void wheel_run(wheel_t *w) {
+	uint64_t target = wheel_clock() / WHEEL_TICK;
+	timeout_t *t, *expired;
+	int level;
+	
+	if (!w->count) {
+		w->now = target;    /* nothing to move along */
+		return;
+	}
+	
+	while (w->now < target) {
+		w->now++;
+		for (level = 1; level < WHEEL_LEVELS &&
+		     !((w->now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK); level++) {
+			wheel_cascade(w, level);
+		}
+		
+		/* Take the slot over first, callbacks may link new timeouts */
+		expired = NULL;
+		if ((t = w->slots[0][w->now & WHEEL_MASK])) {
+			w->slots[0][w->now & WHEEL_MASK] = NULL;
+			expired = t;
+			t->pprev = &expired;
+		}
+		while ((t = expired)) {
+			timeout_unlink(t);
+			w->count--;
+			t->fire(t->data);
+		}
+		
+		if (!w->count) {
+			w->now = target;
+		}
+	}
+}
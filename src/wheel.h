@@ -0,0 +1,57 @@
+/* wheel.h - Timer wheel structures and function prototypes. */
+
+/* Copyright (C) 2008 Evangelos Foutras
+
+   This file is part of Galactic Turtle.
+
+   Galactic Turtle is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Galactic Turtle is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Galactic Turtle.  If not, see <http://www.gnu.org/licenses/>. */
+
+#define WHEEL_TICK 100                        /* milliseconds */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4                        /* about 19 days at most */
+
+/* Something that should happen after a while, unless it's cancelled or
+   pushed back first. It's embedded in whatever it is about. */
+typedef struct timeout_s {
+	struct timeout_s *next, **pprev;          /* pprev is NULL when idle */
+	uint64_t expires;                         /* in ticks */
+	void (*fire)(void *data);
+	void *data;
+} timeout_t;
+
+/* A hierarchical timer wheel. Level 0 has a slot per tick, every level
+   above it a slot per lap of the one below. Timeouts sit in the slot of
+   the coarsest level that can tell their expiry apart and move down as
+   their time comes closer, so adding and cancelling one is O(1). Each
+   shard has its own and only touches it from its own thread. */
+typedef struct wheel_s {
+	uint64_t now;                             /* in ticks */
+	int count;
+	timeout_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel_t;
+
+uint64_t wheel_clock();
+
+void wheel_init(wheel_t *w);
+
+void timeout_init(timeout_t *t, void (*fire)(void *data), void *data);
+
+void wheel_add(wheel_t *w, timeout_t *t, unsigned int ms);
+
+void wheel_cancel(wheel_t *w, timeout_t *t);
+
+int wheel_timeout(wheel_t *w);
+
+void wheel_run(wheel_t *w);